@@ -11,8 +11,8 @@ int main(int argc, const char **argv)
 {
   const char *port = "2022";
 
-  addrinfo resAddrInfo;
-  int sfd = create_dgram_socket("localhost", port, &resAddrInfo);
+  SocketAddress resAddr;
+  int sfd = create_dgram_socket("localhost", port, &resAddr);
 
   if (sfd == -1)
   {
@@ -25,7 +25,7 @@ int main(int argc, const char **argv)
     std::string input;
     printf(">");
     std::getline(std::cin, input);
-    ssize_t res = sendto(sfd, input.c_str(), input.size(), 0, resAddrInfo.ai_addr, resAddrInfo.ai_addrlen);
+    ssize_t res = sendto(sfd, input.c_str(), input.size(), 0, resAddr.get(), resAddr.addrlen);
     if (res == -1)
       std::cout << strerror(errno) << std::endl;
   }
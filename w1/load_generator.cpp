@@ -0,0 +1,118 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <thread>
+#include <vector>
+#include "socket_tools.h"
+#include "udp_transport.h"
+
+// Floods the local server with datagrams for a while and reports the send rate.
+// Run the server with --stats to see how much of it is received. Every sender has its own socket,
+// so with a sharded server their traffic is spread between shards.
+//   load_generator [--legacy] [--senders N] [--dscp N] [seconds] [datagram size]
+
+// Enough for a few batches in flight, the default is dropped into long before the server reads it
+constexpr int kSendBufferSize = 4 * 1024 * 1024;
+
+static double get_time()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static size_t send_load(const char *port, const SocketOptions &options, bool legacy, double end,
+                        size_t datagramSize)
+{
+  SocketAddress resAddr;
+  int sfd = create_dgram_socket("localhost", port, &resAddr, options);
+
+  if (sfd == -1)
+  {
+    printf("Cannot create a socket\n");
+    return 0;
+  }
+
+  static thread_local char payload[kMaxDatagramSize];
+  memset(payload, 'x', datagramSize);
+
+  static thread_local DatagramBatch batch;
+  init_datagram_batch(batch);
+
+  size_t sent = 0;
+  while (get_time() < end)
+  {
+    // The clock is only checked once per batch in both modes
+    if (legacy)
+    {
+      for (size_t i = 0; i < kMaxBatchDatagrams; ++i)
+        if (sendto(sfd, payload, datagramSize, 0, resAddr.get(), resAddr.addrlen) > 0)
+          ++sent;
+    }
+    else
+    {
+      while (push_datagram(batch, payload, datagramSize, resAddr.get(), resAddr.addrlen))
+        ;
+      sent += send_batch(sfd, batch);
+    }
+  }
+  return sent;
+}
+
+int main(int argc, const char **argv)
+{
+  const char *port = "2022";
+
+  SocketOptions options;
+  options.sendBufferSize = kSendBufferSize;
+
+  bool legacy = false;
+  size_t senderCount = 1;
+  double duration = 5.0;
+  size_t datagramSize = 64;
+  int positional = 0;
+  for (int i = 1; i < argc; ++i)
+  {
+    if (strcmp(argv[i], "--legacy") == 0)
+      legacy = true;
+    else if (strcmp(argv[i], "--senders") == 0 && i + 1 < argc)
+      senderCount = strtoul(argv[++i], nullptr, 10);
+    else if (strcmp(argv[i], "--dscp") == 0 && i + 1 < argc)
+      options.tos = atoi(argv[++i]) << 2;
+    else if (positional++ == 0)
+      duration = atof(argv[i]);
+    else
+      datagramSize = strtoul(argv[i], nullptr, 10);
+  }
+  if (datagramSize == 0 || datagramSize > kMaxDatagramSize)
+  {
+    printf("Datagram size must be within [1, %zu]\n", kMaxDatagramSize);
+    return 1;
+  }
+  if (senderCount == 0)
+    senderCount = 1;
+
+  double start = get_time();
+  double end = start + duration;
+
+  std::vector<size_t> sent(senderCount, 0);
+  std::vector<std::thread> senders;
+  for (size_t i = 0; i < senderCount; ++i)
+    senders.emplace_back([&, i]() { sent[i] = send_load(port, options, legacy, end, datagramSize); });
+
+  size_t total = 0;
+  for (size_t i = 0; i < senderCount; ++i)
+  {
+    senders[i].join();
+    total += sent[i];
+  }
+
+  double elapsed = get_time() - start;
+  printf("%s x%zu: sent %zu datagrams in %.2f s, %.0f datagrams/s\n", legacy ? "sendto" : "sendmmsg",
+         senderCount, total, elapsed, total / elapsed);
+  return 0;
+}
@@ -1,22 +1,68 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/select.h>
+#include <sys/epoll.h>
 #include <netdb.h>
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
 #include <cstring>
 #include <cstdio>
+#include <cstdlib>
 #include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
 #include "socket_tools.h"
+#include "udp_transport.h"
 
-int main(int argc, const char **argv)
+// Every shard owns a socket and the thread receiving from it. Counters take a cache line each so
+// that shards never write to the same one, the main thread merges them for reporting.
+struct alignas(64) ShardCounters
 {
-  const char *port = "2022";
+  std::atomic<uint64_t> received{0};
+  // Time from the kernel receiving a datagram to it being handled, with --timestamps
+  std::atomic<uint64_t> latencySumNs{0};
+  std::atomic<uint64_t> latencyCount{0};
+  std::atomic<uint64_t> latencyMaxNs{0};
+};
+
+// Bursts are absorbed by the kernel instead of being dropped while a shard is busy
+constexpr int kReceiveBufferSize = 4 * 1024 * 1024;
+
+static bool printStats = false;
+
+static void on_datagram(ShardCounters &counters, const char *data, size_t size)
+{
+  counters.received.fetch_add(1, std::memory_order_relaxed);
+  if (!printStats)
+    printf("%.*s\n", int(size), data); // assume that data is a string
+}
 
-  int sfd = create_dgram_socket(nullptr, port, nullptr);
+static void on_receive_timestamp(ShardCounters &counters, const timespec &received)
+{
+  // SO_TIMESTAMPNS stamps with CLOCK_REALTIME
+  timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  int64_t latencyNs = (now.tv_sec - received.tv_sec) * 1000000000ll + (now.tv_nsec - received.tv_nsec);
+  if (latencyNs < 0)
+    return;
 
-  if (sfd == -1)
-    return 1;
-  printf("listening!\n");
+  counters.latencySumNs.fetch_add(latencyNs, std::memory_order_relaxed);
+  counters.latencyCount.fetch_add(1, std::memory_order_relaxed);
+  // The reporter resets the maximum concurrently
+  uint64_t maxNs = counters.latencyMaxNs.load(std::memory_order_relaxed);
+  while (uint64_t(latencyNs) > maxNs &&
+         !counters.latencyMaxNs.compare_exchange_weak(maxNs, latencyNs, std::memory_order_relaxed))
+    ;
+}
 
+// One select and one recvfrom per wakeup
+static void run_legacy(int sfd, ShardCounters &counters)
+{
   while (true)
   {
     fd_set readSet;
@@ -30,13 +76,157 @@ int main(int argc, const char **argv)
     if (FD_ISSET(sfd, &readSet))
     {
       constexpr size_t buf_size = 1000;
-      static char buffer[buf_size];
-      memset(buffer, 0, buf_size);
+      static thread_local char buffer[buf_size];
 
-      ssize_t numBytes = recvfrom(sfd, buffer, buf_size - 1, 0, nullptr, nullptr);
+      ssize_t numBytes = recvfrom(sfd, buffer, buf_size, 0, nullptr, nullptr);
       if (numBytes > 0)
-        printf("%s\n", buffer); // assume that buffer is a string
+        on_datagram(counters, buffer, numBytes);
+    }
+  }
+}
+
+// Every wakeup drains the socket a batch of datagrams per syscall
+static void run_batched(int sfd, ShardCounters &counters)
+{
+  int efd = create_epoll_for_socket(sfd);
+  if (efd == -1)
+  {
+    printf("Cannot create epoll: %s\n", strerror(errno));
+    return;
+  }
+
+  static thread_local DatagramBatch batch;
+  init_datagram_batch(batch);
+
+  while (true)
+  {
+    epoll_event event;
+    epoll_wait(efd, &event, 1, 100); // 100 ms
+
+    int count = 0;
+    while ((count = receive_batch(sfd, batch)) > 0)
+    {
+      for (int i = 0; i < count; ++i)
+      {
+        timespec received;
+        if (get_receive_timestamp(batch, i, received))
+          on_receive_timestamp(counters, received);
+        on_datagram(counters, batch.buffers[i], batch.headers[i].msg_len);
+      }
+    }
+    if (count == -1)
+      printf("Cannot receive: %s\n", strerror(errno));
+  }
+}
+
+static void pin_to_cpu(std::thread &thread, size_t cpu)
+{
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  if (pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus) != 0)
+    printf("Cannot pin shard to cpu %zu\n", cpu);
+}
+
+static void report_stats(std::vector<ShardCounters> &counters)
+{
+  std::vector<uint64_t> lastReceived(counters.size(), 0);
+  auto lastReportTime = std::chrono::steady_clock::now();
+  while (true)
+  {
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - lastReportTime).count();
+    lastReportTime = now;
+
+    uint64_t total = 0;
+    uint64_t latencySumNs = 0;
+    uint64_t latencyCount = 0;
+    uint64_t latencyMaxNs = 0;
+    std::string perShard;
+    for (size_t i = 0; i < counters.size(); ++i)
+    {
+      uint64_t received = counters[i].received.load(std::memory_order_relaxed);
+      total += received - lastReceived[i];
+      if (counters.size() > 1)
+        perShard += " " + std::to_string(uint64_t((received - lastReceived[i]) / elapsed));
+      lastReceived[i] = received;
+
+      latencySumNs += counters[i].latencySumNs.exchange(0, std::memory_order_relaxed);
+      latencyCount += counters[i].latencyCount.exchange(0, std::memory_order_relaxed);
+      latencyMaxNs = std::max(latencyMaxNs, counters[i].latencyMaxNs.exchange(0, std::memory_order_relaxed));
     }
+
+    std::string latency;
+    if (latencyCount > 0)
+      latency = ", kernel to handler avg " + std::to_string(latencySumNs / latencyCount / 1000) +
+                " us max " + std::to_string(latencyMaxNs / 1000) + " us";
+
+    if (counters.size() > 1)
+      printf("%.0f datagrams/s%s, per shard:%s\n", total / elapsed, latency.c_str(), perShard.c_str());
+    else
+      printf("%.0f datagrams/s%s\n", total / elapsed, latency.c_str());
+    fflush(stdout);
+  }
+}
+
+int main(int argc, const char **argv)
+{
+  const char *port = "2022";
+
+  SocketOptions options;
+  options.receiveBufferSize = kReceiveBufferSize;
+
+  bool legacy = false;
+  size_t shardCount = 1;
+  for (int i = 1; i < argc; ++i)
+  {
+    if (strcmp(argv[i], "--legacy") == 0)
+      legacy = true;
+    else if (strcmp(argv[i], "--stats") == 0)
+      printStats = true;
+    else if (strcmp(argv[i], "--shards") == 0 && i + 1 < argc)
+      shardCount = strtoul(argv[++i], nullptr, 10); // 0 is one shard per core
+    else if (strcmp(argv[i], "--rcvbuf") == 0 && i + 1 < argc)
+      options.receiveBufferSize = atoi(argv[++i]); // 0 is the kernel default
+    else if (strcmp(argv[i], "--busy-poll") == 0 && i + 1 < argc)
+      options.busyPollUs = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--timestamps") == 0)
+      options.receiveTimestamps = true; // the legacy loop doesn't read them
+  }
+
+  size_t cpuCount = std::max(1u, std::thread::hardware_concurrency());
+  if (shardCount == 0)
+    shardCount = cpuCount;
+  options.reusePort = shardCount > 1;
+
+  // Every socket is bound before any thread starts, so no datagram lands in a socket without a reader
+  std::vector<int> sockets;
+  for (size_t i = 0; i < shardCount; ++i)
+  {
+    int sfd = create_dgram_socket(nullptr, port, nullptr, options);
+    if (sfd == -1)
+      return 1;
+    sockets.push_back(sfd);
   }
+  if (options.reusePort)
+    printf("listening with %zu shards!\n", shardCount);
+  else
+    printf("listening!\n");
+
+  std::vector<ShardCounters> counters(shardCount);
+  std::vector<std::thread> shards;
+  for (size_t i = 0; i < shardCount; ++i)
+  {
+    shards.emplace_back(legacy ? run_legacy : run_batched, sockets[i], std::ref(counters[i]));
+    if (options.reusePort)
+      pin_to_cpu(shards.back(), i % cpuCount);
+  }
+
+  if (printStats)
+    report_stats(counters);
+
+  for (std::thread &shard : shards)
+    shard.join();
   return 0;
 }
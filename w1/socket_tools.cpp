@@ -1,16 +1,51 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/select.h>
+#include <netinet/in.h>
 #include <netdb.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <cerrno>
 #include <cstring>
 #include <stdio.h>
 
 #include "socket_tools.h"
 
+// Tuning knobs are best effort, a socket missing one still works
+static void set_tuning_options(int sfd, const SocketOptions &options)
+{
+  if (options.receiveBufferSize > 0)
+  {
+    int size = 0;
+    socklen_t len = sizeof(size);
+    setsockopt(sfd, SOL_SOCKET, SO_RCVBUF, &options.receiveBufferSize, sizeof(int));
+    // The kernel doubles the value for its bookkeeping
+    if (getsockopt(sfd, SOL_SOCKET, SO_RCVBUF, &size, &len) == 0 && size / 2 < options.receiveBufferSize)
+      printf("SO_RCVBUF capped to %d bytes, see net.core.rmem_max\n", size / 2);
+  }
+
+  if (options.sendBufferSize > 0)
+  {
+    int size = 0;
+    socklen_t len = sizeof(size);
+    setsockopt(sfd, SOL_SOCKET, SO_SNDBUF, &options.sendBufferSize, sizeof(int));
+    if (getsockopt(sfd, SOL_SOCKET, SO_SNDBUF, &size, &len) == 0 && size / 2 < options.sendBufferSize)
+      printf("SO_SNDBUF capped to %d bytes, see net.core.wmem_max\n", size / 2);
+  }
+
+  if (options.busyPollUs > 0 && setsockopt(sfd, SOL_SOCKET, SO_BUSY_POLL, &options.busyPollUs, sizeof(int)) != 0)
+    printf("Cannot set SO_BUSY_POLL: %s\n", strerror(errno));
+
+  if (options.tos >= 0 && setsockopt(sfd, IPPROTO_IP, IP_TOS, &options.tos, sizeof(int)) != 0)
+    printf("Cannot set IP_TOS: %s\n", strerror(errno));
+
+  int trueVal = 1;
+  if (options.receiveTimestamps && setsockopt(sfd, SOL_SOCKET, SO_TIMESTAMPNS, &trueVal, sizeof(int)) != 0)
+    printf("Cannot set SO_TIMESTAMPNS: %s\n", strerror(errno));
+}
+
 // Adaptation of linux man page: https://linux.die.net/man/3/getaddrinfo
-static int get_dgram_socket(addrinfo *addr, bool should_bind, addrinfo *res_addr)
+static int get_dgram_socket(addrinfo *addr, bool should_bind, SocketAddress *res_addr, const SocketOptions &options)
 {
   for (addrinfo *ptr = addr; ptr != nullptr; ptr = ptr->ai_next)
   {
@@ -20,13 +55,23 @@ static int get_dgram_socket(addrinfo *addr, bool should_bind, addrinfo *res_addr
     if (sfd == -1)
       continue;
 
-    fcntl(sfd, F_SETFL, O_NONBLOCK);
+    fcntl(sfd, F_SETFL, fcntl(sfd, F_GETFL) | O_NONBLOCK);
 
     int trueVal = 1;
     setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, &trueVal, sizeof(int));
+    if (options.reusePort && setsockopt(sfd, SOL_SOCKET, SO_REUSEPORT, &trueVal, sizeof(int)) != 0)
+    {
+      close(sfd);
+      continue;
+    }
+
+    set_tuning_options(sfd, options);
 
     if (res_addr)
-      *res_addr = *ptr;
+    {
+      memcpy(&res_addr->addr, ptr->ai_addr, ptr->ai_addrlen);
+      res_addr->addrlen = ptr->ai_addrlen;
+    }
     if (!should_bind)
       return sfd;
 
@@ -38,7 +83,7 @@ static int get_dgram_socket(addrinfo *addr, bool should_bind, addrinfo *res_addr
   return -1;
 }
 
-int create_dgram_socket(const char *address, const char *port, addrinfo *res_addr)
+int create_dgram_socket(const char *address, const char *port, SocketAddress *res_addr, const SocketOptions &options)
 {
   addrinfo hints;
   memset(&hints, 0, sizeof(addrinfo));
@@ -51,12 +96,15 @@ int create_dgram_socket(const char *address, const char *port, addrinfo *res_add
     hints.ai_flags = AI_PASSIVE;
 
   addrinfo *result = nullptr;
-  if (getaddrinfo(address, port, &hints, &result) != 0)
-    return 1;
+  int error = getaddrinfo(address, port, &hints, &result);
+  if (error != 0)
+  {
+    printf("Cannot resolve %s:%s: %s\n", address ? address : "*", port, gai_strerror(error));
+    return -1;
+  }
 
-  int sfd = get_dgram_socket(result, isListener, res_addr);
+  int sfd = get_dgram_socket(result, isListener, res_addr, options);
 
-  //freeaddrinfo(result);
+  freeaddrinfo(result);
   return sfd;
 }
-
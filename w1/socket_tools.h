@@ -1,5 +1,32 @@
 #pragma once
+#include <sys/socket.h>
 
-struct addrinfo;
+// Address the socket was created for, a copy that outlives the getaddrinfo list
+struct SocketAddress
+{
+  sockaddr_storage addr;
+  socklen_t addrlen;
 
-int create_dgram_socket(const char *address, const char *port, addrinfo *res_addr);
+  const sockaddr *get() const { return (const sockaddr *)&addr; }
+};
+
+struct SocketOptions
+{
+  // Several sockets can be bound to the same port, the kernel spreads incoming datagrams between
+  // them by source address
+  bool reusePort = false;
+  // SO_RCVBUF/SO_SNDBUF in bytes, 0 keeps the kernel default. Bursts beyond the receive buffer are
+  // dropped by the kernel, the request is capped by net.core.rmem_max/wmem_max
+  int receiveBufferSize = 0;
+  int sendBufferSize = 0;
+  // SO_BUSY_POLL, microseconds to busy poll the device queue on blocking receives, 0 disables
+  int busyPollUs = 0;
+  // IP_TOS, DSCP goes into the upper 6 bits. -1 keeps the default
+  int tos = -1;
+  // SO_TIMESTAMPNS, every received datagram carries the kernel's CLOCK_REALTIME receive time
+  bool receiveTimestamps = false;
+};
+
+// Returns -1 on failure. res_addr may be nullptr
+int create_dgram_socket(const char *address, const char *port, SocketAddress *res_addr,
+                        const SocketOptions &options = SocketOptions());
@@ -0,0 +1,108 @@
+#include <sys/epoll.h>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+#include "udp_transport.h"
+
+void init_datagram_batch(DatagramBatch &batch)
+{
+  memset(batch.headers, 0, sizeof(batch.headers));
+  for (size_t i = 0; i < kMaxBatchDatagrams; ++i)
+  {
+    batch.iovecs[i].iov_base = batch.buffers[i];
+    batch.iovecs[i].iov_len = kMaxDatagramSize;
+
+    msghdr &header = batch.headers[i].msg_hdr;
+    header.msg_iov = &batch.iovecs[i];
+    header.msg_iovlen = 1;
+    header.msg_name = &batch.addresses[i];
+    header.msg_namelen = sizeof(batch.addresses[i]);
+  }
+  batch.count = 0;
+}
+
+int receive_batch(int sfd, DatagramBatch &batch)
+{
+  // Sizes are in-out arguments, a previous batch may have shrunk them
+  for (size_t i = 0; i < kMaxBatchDatagrams; ++i)
+  {
+    batch.iovecs[i].iov_len = kMaxDatagramSize;
+    batch.headers[i].msg_hdr.msg_namelen = sizeof(batch.addresses[i]);
+    batch.headers[i].msg_hdr.msg_control = batch.controls[i];
+    batch.headers[i].msg_hdr.msg_controllen = kDatagramControlSize;
+  }
+
+  int received = recvmmsg(sfd, batch.headers, kMaxBatchDatagrams, MSG_DONTWAIT, nullptr);
+  if (received == -1)
+  {
+    batch.count = 0;
+    return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+  }
+
+  batch.count = received;
+  return received;
+}
+
+bool get_receive_timestamp(const DatagramBatch &batch, size_t i, timespec &ts)
+{
+  msghdr *header = const_cast<msghdr *>(&batch.headers[i].msg_hdr);
+  for (cmsghdr *cmsg = CMSG_FIRSTHDR(header); cmsg != nullptr; cmsg = CMSG_NXTHDR(header, cmsg))
+  {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+    {
+      memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+      return true;
+    }
+  }
+  return false;
+}
+
+bool push_datagram(DatagramBatch &batch, const void *data, size_t size, const sockaddr *addr, socklen_t addrlen)
+{
+  if (batch.count == kMaxBatchDatagrams || size > kMaxDatagramSize || addrlen > sizeof(sockaddr_in))
+    return false;
+
+  size_t i = batch.count++;
+  memcpy(batch.buffers[i], data, size);
+  batch.iovecs[i].iov_len = size;
+  memcpy(&batch.addresses[i], addr, addrlen);
+  batch.headers[i].msg_hdr.msg_namelen = addrlen;
+  batch.headers[i].msg_hdr.msg_control = nullptr;
+  batch.headers[i].msg_hdr.msg_controllen = 0;
+  return true;
+}
+
+int send_batch(int sfd, DatagramBatch &batch)
+{
+  size_t sent = 0;
+  while (sent < batch.count)
+  {
+    // sendmmsg stops at the first datagram which can't be sent, the rest is retried
+    int res = sendmmsg(sfd, batch.headers + sent, batch.count - sent, 0);
+    if (res <= 0)
+      break;
+    sent += res;
+  }
+
+  batch.count = 0;
+  return sent;
+}
+
+int create_epoll_for_socket(int sfd)
+{
+  int efd = epoll_create1(0);
+  if (efd == -1)
+    return -1;
+
+  epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN | EPOLLET;
+  event.data.fd = sfd;
+  if (epoll_ctl(efd, EPOLL_CTL_ADD, sfd, &event) == -1)
+  {
+    close(efd);
+    return -1;
+  }
+  return efd;
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <cstddef>
+#include <ctime>
+
+constexpr size_t kMaxBatchDatagrams = 64;
+constexpr size_t kMaxDatagramSize = 1500;
+// Room for the SO_TIMESTAMPNS control message
+constexpr size_t kDatagramControlSize = CMSG_SPACE(sizeof(timespec));
+
+// Preallocated headers, iovecs and buffers to move a batch of datagrams with one syscall
+struct DatagramBatch
+{
+  mmsghdr headers[kMaxBatchDatagrams];
+  iovec iovecs[kMaxBatchDatagrams];
+  sockaddr_in addresses[kMaxBatchDatagrams];
+  char buffers[kMaxBatchDatagrams][kMaxDatagramSize];
+  alignas(cmsghdr) char controls[kMaxBatchDatagrams][kDatagramControlSize];
+  size_t count;
+};
+
+void init_datagram_batch(DatagramBatch &batch);
+
+// Receives up to kMaxBatchDatagrams datagrams, every headers[i].msg_len is the size of buffers[i].
+// Returns 0 once the socket is drained and -1 on error
+int receive_batch(int sfd, DatagramBatch &batch);
+// Kernel receive time of the i-th received datagram, false unless the socket was created with
+// receiveTimestamps
+bool get_receive_timestamp(const DatagramBatch &batch, size_t i, timespec &ts);
+
+// Appends a datagram to be sent, false if the batch is full, size exceeds kMaxDatagramSize or
+// addrlen exceeds sizeof(sockaddr_in)
+bool push_datagram(DatagramBatch &batch, const void *data, size_t size, const sockaddr *addr, socklen_t addrlen);
+// Sends the queued datagrams and clears the batch, returns how many of them were sent
+int send_batch(int sfd, DatagramBatch &batch);
+
+// Returns an epoll instance watching the socket for edge-triggered reads, -1 on error.
+// An edge is only reported once per burst, so the socket must be drained on every wakeup
+int create_epoll_for_socket(int sfd);
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+template<typename T, int num_bits>
+struct PackedFloat;
+
+class Bitstream {
+public:
+  // Owning stream, storage grows geometrically
+  Bitstream() = default;
+  // Read-only view, parses data in place without copying it
+  Bitstream(const void* data, size_t size);
+
+  ~Bitstream();
+
+  Bitstream(const Bitstream& other) = delete;
+
+  // Writes straight into a caller-provided buffer (e.g. ENetPacket::data), never reallocates
+  static Bitstream Wrap(void* buffer, size_t capacity);
+
+  // Number of bytes spanned by the unread bits
+  size_t Size() const;
+  const uint8_t* Data() const;
+
+  void Reset();
+  void Reserve(size_t capacity);
+
+  void Write(const void* data, size_t size);
+  void Read(void* out_data, size_t size);
+  void Skip(size_t size);
+
+  // Bit-granular access, num_bits <= 32, bits are stored LSB first
+  void WriteBits(uint32_t value, uint32_t num_bits);
+  uint32_t ReadBits(uint32_t num_bits);
+
+  template<typename T>
+  void Write(const T& value) {
+    Write(&value, sizeof(T));
+  }
+
+  template<typename T>
+  void Read(T& out_value) {
+    Read(&out_value, sizeof(T));
+  }
+
+  // Quantised values only take their num_bits on the wire
+  template<typename T, int num_bits>
+  void Write(const PackedFloat<T, num_bits>& value) {
+    WriteBits(value.packedVal, num_bits);
+  }
+
+  template<typename T, int num_bits>
+  void Read(PackedFloat<T, num_bits>& out_value) {
+    out_value.packedVal = static_cast<T>(ReadBits(num_bits));
+  }
+
+  template<typename T>
+  void Skip() {
+    Skip(sizeof(T));
+  }
+
+private:
+  Bitstream(uint8_t* data, size_t capacity, size_t size, bool read_only);
+
+  void EnsureCapacity(size_t num_bits);
+
+  uint8_t* data_{nullptr};
+  size_t capacity_{0};
+  bool owns_data_{true};
+  bool read_only_{false};
+
+  size_t read_bit_{0};
+  size_t write_bit_{0};
+};
\ No newline at end of file
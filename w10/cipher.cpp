@@ -0,0 +1,179 @@
+#include "cipher.hpp"
+
+#include <cstring>
+
+#include "crc32c.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static constexpr size_t kBlockSize = 64;
+
+static uint32_t rotl(uint32_t value, int shift) {
+  return (value << shift) | (value >> (32 - shift));
+}
+
+static void quarter_round(uint32_t& a, uint32_t& b, uint32_t& c, uint32_t& d) {
+  a += b; d ^= a; d = rotl(d, 16);
+  c += d; b ^= c; b = rotl(b, 12);
+  a += b; d ^= a; d = rotl(d, 8);
+  c += d; b ^= c; b = rotl(b, 7);
+}
+
+// Original ChaCha layout: 64-bit block counter followed by a 64-bit nonce
+static void chacha20_block(const CipherKey& key, uint64_t nonce, uint64_t counter, uint32_t out[16]) {
+  uint32_t input[16] = {
+      0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,  // "expand 32-byte k"
+      key.words[0], key.words[1], key.words[2], key.words[3],
+      key.words[4], key.words[5], key.words[6], key.words[7],
+      uint32_t(counter), uint32_t(counter >> 32), uint32_t(nonce), uint32_t(nonce >> 32)};
+
+  uint32_t x[16];
+  std::memcpy(x, input, sizeof(x));
+  for (int round = 0; round < 20; round += 2) {
+    quarter_round(x[0], x[4], x[8], x[12]);
+    quarter_round(x[1], x[5], x[9], x[13]);
+    quarter_round(x[2], x[6], x[10], x[14]);
+    quarter_round(x[3], x[7], x[11], x[15]);
+    quarter_round(x[0], x[5], x[10], x[15]);
+    quarter_round(x[1], x[6], x[11], x[12]);
+    quarter_round(x[2], x[7], x[8], x[13]);
+    quarter_round(x[3], x[4], x[9], x[14]);
+  }
+
+  for (int i = 0; i < 16; ++i) {
+    out[i] = x[i] + input[i];
+  }
+}
+
+#if defined(__SSE2__)
+template <int Shift>
+static __m128i rotl4(__m128i value) {
+  return _mm_or_si128(_mm_slli_epi32(value, Shift), _mm_srli_epi32(value, 32 - Shift));
+}
+
+static void quarter_round4(__m128i& a, __m128i& b, __m128i& c, __m128i& d) {
+  a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = rotl4<16>(d);
+  c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = rotl4<12>(b);
+  a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); d = rotl4<8>(d);
+  c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); b = rotl4<7>(b);
+}
+
+// Four consecutive blocks at once, lane i of every state word belongs to block counter + i. The
+// keystream is XORed into 4 * kBlockSize bytes of data.
+static void chacha20_xor4(const CipherKey& key, uint64_t nonce, uint64_t counter, uint8_t* data) {
+  __m128i input[16] = {
+      _mm_set1_epi32(0x61707865), _mm_set1_epi32(0x3320646e), _mm_set1_epi32(0x79622d32), _mm_set1_epi32(0x6b206574),
+      _mm_set1_epi32(key.words[0]), _mm_set1_epi32(key.words[1]), _mm_set1_epi32(key.words[2]), _mm_set1_epi32(key.words[3]),
+      _mm_set1_epi32(key.words[4]), _mm_set1_epi32(key.words[5]), _mm_set1_epi32(key.words[6]), _mm_set1_epi32(key.words[7]),
+      _mm_set_epi32(uint32_t(counter + 3), uint32_t(counter + 2), uint32_t(counter + 1), uint32_t(counter)),
+      _mm_set_epi32(uint32_t((counter + 3) >> 32), uint32_t((counter + 2) >> 32), uint32_t((counter + 1) >> 32),
+                    uint32_t(counter >> 32)),
+      _mm_set1_epi32(uint32_t(nonce)), _mm_set1_epi32(uint32_t(nonce >> 32))};
+
+  __m128i x[16];
+  for (int i = 0; i < 16; ++i) {
+    x[i] = input[i];
+  }
+  for (int round = 0; round < 20; round += 2) {
+    quarter_round4(x[0], x[4], x[8], x[12]);
+    quarter_round4(x[1], x[5], x[9], x[13]);
+    quarter_round4(x[2], x[6], x[10], x[14]);
+    quarter_round4(x[3], x[7], x[11], x[15]);
+    quarter_round4(x[0], x[5], x[10], x[15]);
+    quarter_round4(x[1], x[6], x[11], x[12]);
+    quarter_round4(x[2], x[7], x[8], x[13]);
+    quarter_round4(x[3], x[4], x[9], x[14]);
+  }
+
+  // Transposing each group of 4 words gives 16 contiguous keystream bytes of every block
+  for (int group = 0; group < 4; ++group) {
+    __m128i a = _mm_add_epi32(x[4 * group + 0], input[4 * group + 0]);
+    __m128i b = _mm_add_epi32(x[4 * group + 1], input[4 * group + 1]);
+    __m128i c = _mm_add_epi32(x[4 * group + 2], input[4 * group + 2]);
+    __m128i d = _mm_add_epi32(x[4 * group + 3], input[4 * group + 3]);
+
+    __m128i ab_lo = _mm_unpacklo_epi32(a, b);
+    __m128i cd_lo = _mm_unpacklo_epi32(c, d);
+    __m128i ab_hi = _mm_unpackhi_epi32(a, b);
+    __m128i cd_hi = _mm_unpackhi_epi32(c, d);
+    __m128i blocks[4] = {_mm_unpacklo_epi64(ab_lo, cd_lo), _mm_unpackhi_epi64(ab_lo, cd_lo),
+                         _mm_unpacklo_epi64(ab_hi, cd_hi), _mm_unpackhi_epi64(ab_hi, cd_hi)};
+
+    for (int block = 0; block < 4; ++block) {
+      __m128i* chunk = reinterpret_cast<__m128i*>(data + block * kBlockSize + group * 16);
+      _mm_storeu_si128(chunk, _mm_xor_si128(_mm_loadu_si128(chunk), blocks[block]));
+    }
+  }
+}
+#endif
+
+enum CrcMode {
+  kNoCrc,
+  kCrcBeforeXor,  // Data holds the ciphertext, decrypting
+  kCrcAfterXor    // Data holds the plaintext, encrypting
+};
+
+// Every chunk's CRC is taken right before or after XORing it, while it is still in cache
+static uint32_t xor_keystream(const CipherKey& key, uint64_t nonce, uint8_t* data, size_t size, CrcMode mode,
+                              uint32_t crc) {
+  uint32_t keystream[16];
+  uint64_t counter = 0;
+
+#if defined(__SSE2__)
+  for (; size >= 4 * kBlockSize; data += 4 * kBlockSize, size -= 4 * kBlockSize, counter += 4) {
+    if (mode == kCrcBeforeXor) {
+      crc = crc32c(crc, data, 4 * kBlockSize);
+    }
+    chacha20_xor4(key, nonce, counter, data);
+    if (mode == kCrcAfterXor) {
+      crc = crc32c(crc, data, 4 * kBlockSize);
+    }
+  }
+#endif
+
+  // Whole blocks are XORed a 64-bit word at a time, the keystream words are little endian as on x86
+  for (; size >= kBlockSize; data += kBlockSize, size -= kBlockSize) {
+    if (mode == kCrcBeforeXor) {
+      crc = crc32c(crc, data, kBlockSize);
+    }
+    chacha20_block(key, nonce, counter++, keystream);
+    for (size_t offset = 0; offset < kBlockSize; offset += sizeof(uint64_t)) {
+      uint64_t word;
+      uint64_t stream;
+      std::memcpy(&word, data + offset, sizeof(word));
+      std::memcpy(&stream, reinterpret_cast<const uint8_t*>(keystream) + offset, sizeof(stream));
+      word ^= stream;
+      std::memcpy(data + offset, &word, sizeof(word));
+    }
+    if (mode == kCrcAfterXor) {
+      crc = crc32c(crc, data, kBlockSize);
+    }
+  }
+
+  if (size > 0) {
+    if (mode == kCrcBeforeXor) {
+      crc = crc32c(crc, data, size);
+    }
+    chacha20_block(key, nonce, counter, keystream);
+    const uint8_t* stream = reinterpret_cast<const uint8_t*>(keystream);
+    for (size_t i = 0; i < size; ++i) {
+      data[i] ^= stream[i];
+    }
+    if (mode == kCrcAfterXor) {
+      crc = crc32c(crc, data, size);
+    }
+  }
+
+  return crc;
+}
+
+void chacha20_xor(const CipherKey& key, uint64_t nonce, uint8_t* data, size_t size) {
+  xor_keystream(key, nonce, data, size, kNoCrc, 0);
+}
+
+uint32_t chacha20_xor_crc32c(const CipherKey& key, uint64_t nonce, uint8_t* data, size_t size, bool encrypt,
+                             uint32_t crc) {
+  return xor_keystream(key, nonce, data, size, encrypt ? kCrcAfterXor : kCrcBeforeXor, crc);
+}
\ No newline at end of file
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+struct CipherKey {
+  uint32_t words[8] = {};
+};
+
+// XORs data with the ChaCha20 keystream of key and nonce, which both encrypts and decrypts. A nonce
+// must never be used twice with the same key.
+void chacha20_xor(const CipherKey& key, uint64_t nonce, uint8_t* data, size_t size);
+
+// Same as chacha20_xor, also returns CRC32C of the ciphertext continuing from crc, computed in the same
+// pass. encrypt tells whether data holds the plaintext (encrypting) or the ciphertext (decrypting).
+// The checksum of the ciphertext tells an observer nothing about the plaintext.
+uint32_t chacha20_xor_crc32c(const CipherKey& key, uint64_t nonce, uint8_t* data, size_t size, bool encrypt,
+                             uint32_t crc);
\ No newline at end of file
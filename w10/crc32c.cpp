@@ -0,0 +1,79 @@
+#include "crc32c.hpp"
+
+#include <array>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define CRC32C_SSE42
+#include <nmmintrin.h>
+#endif
+
+// Reflected Castagnoli polynomial
+static constexpr uint32_t kPolynomial = 0x82f63b78;
+
+static constexpr std::array<uint32_t, 256> kTable = []() {
+  std::array<uint32_t, 256> table{};
+  for (uint32_t i = 0; i < 256; ++i) {
+    uint32_t crc = i;
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = (crc >> 1) ^ (crc & 1 ? kPolynomial : 0);
+    }
+    table[i] = crc;
+  }
+  return table;
+}();
+
+static uint32_t crc32c_table(uint32_t crc, const uint8_t* data, size_t size) {
+  crc = ~crc;
+  for (size_t i = 0; i < size; ++i) {
+    crc = kTable[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+#ifdef CRC32C_SSE42
+__attribute__((target("sse4.2"))) static uint32_t crc32c_sse42(uint32_t crc, const uint8_t* data, size_t size) {
+  crc = ~crc;
+#if defined(__x86_64__)
+  uint64_t crc64 = crc;
+  for (; size >= sizeof(uint64_t); data += sizeof(uint64_t), size -= sizeof(uint64_t)) {
+    uint64_t word;
+    std::memcpy(&word, data, sizeof(word));
+    crc64 = _mm_crc32_u64(crc64, word);
+  }
+  crc = static_cast<uint32_t>(crc64);
+#endif
+  for (; size > 0; ++data, --size) {
+    crc = _mm_crc32_u8(crc, *data);
+  }
+  return ~crc;
+}
+
+static bool has_sse42() {
+  static const bool kHasSse42 = []() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2") != 0;
+  }();
+  return kHasSse42;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const uint8_t* data, size_t size) {
+#ifdef CRC32C_SSE42
+  if (has_sse42()) {
+    return crc32c_sse42(crc, data, size);
+  }
+#endif
+
+  return crc32c_table(crc, data, size);
+}
+
+const char* crc32c_isa() {
+#ifdef CRC32C_SSE42
+  if (has_sse42()) {
+    return "sse4.2";
+  }
+#endif
+
+  return "table";
+}
\ No newline at end of file
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// CRC32C (Castagnoli) of data continuing from crc, start with 0. Uses the SSE4.2 crc32 instruction
+// when the CPU has it, a lookup table otherwise. Both give the same result.
+uint32_t crc32c(uint32_t crc, const uint8_t* data, size_t size);
+
+// Instruction set crc32c runs with on this machine, "sse4.2" or "table"
+const char* crc32c_isa();
\ No newline at end of file
@@ -0,0 +1,55 @@
+#include "dispatcher.hpp"
+
+#include <cassert>
+#include <cstdio>
+#include <numeric>
+
+void MessageDispatcher::Register(MessageType type, Handler handler) {
+  assert(type < E_MESSAGE_TYPE_COUNT && handler != nullptr);
+  entries_[type] = {handler, get_message_size_limits(type)};
+}
+
+bool MessageDispatcher::Drop(DropReason reason) {
+  ++drops_[reason];
+  return false;
+}
+
+bool MessageDispatcher::Dispatch(ENetPacket* packet, ENetPeer* peer) {
+  if (packet->dataLength == 0) {
+    return Drop(E_DROP_EMPTY);
+  }
+
+  uint8_t type = packet->data[0];
+  if (type >= E_MESSAGE_TYPE_COUNT) {
+    return Drop(E_DROP_UNKNOWN_TYPE);
+  }
+
+  const Entry& entry = entries_[type];
+  if (entry.handler == nullptr) {
+    return Drop(E_DROP_NO_HANDLER);
+  }
+  if (packet->dataLength < entry.limits.min || packet->dataLength > entry.limits.max) {
+    return Drop(E_DROP_BAD_SIZE);
+  }
+  if (!entry.handler(packet, peer)) {
+    return Drop(E_DROP_MALFORMED);
+  }
+
+  ++dispatched_;
+  return true;
+}
+
+void MessageDispatcher::ReportDrops(const char* name) {
+  uint64_t total = std::accumulate(drops_.begin(), drops_.end(), uint64_t(0));
+  if (total == reported_drops_) {
+    return;
+  }
+  reported_drops_ = total;
+
+  printf("%s dropped %llu packets (dispatched %llu): empty %llu, unknown type %llu, no handler %llu, "
+         "bad size %llu, malformed %llu\n",
+         name, (unsigned long long)total, (unsigned long long)dispatched_,
+         (unsigned long long)drops_[E_DROP_EMPTY], (unsigned long long)drops_[E_DROP_UNKNOWN_TYPE],
+         (unsigned long long)drops_[E_DROP_NO_HANDLER], (unsigned long long)drops_[E_DROP_BAD_SIZE],
+         (unsigned long long)drops_[E_DROP_MALFORMED]);
+}
\ No newline at end of file
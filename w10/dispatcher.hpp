@@ -0,0 +1,49 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "protocol.h"
+
+enum DropReason : uint8_t
+{
+  E_DROP_EMPTY = 0,     // No message type
+  E_DROP_UNKNOWN_TYPE,  // Type isn't a MessageType
+  E_DROP_NO_HANDLER,    // Type isn't expected on this side
+  E_DROP_BAD_SIZE,      // Size outside of the type's limits
+  E_DROP_MALFORMED,     // The handler failed to parse it
+  E_DROP_REASON_COUNT
+};
+
+// Routes received packets to handlers by their MessageType through a table. Before a handler runs
+// the packet's size is checked against the limits of its type, so handlers may parse it in place
+// without further length checks. Dropped packets are counted per reason.
+class MessageDispatcher {
+public:
+  // Returns false if the packet turned out to be malformed
+  using Handler = bool (*)(ENetPacket* packet, ENetPeer* peer);
+
+  void Register(MessageType type, Handler handler);
+
+  // Returns false if the packet was dropped, the packet is never destroyed
+  bool Dispatch(ENetPacket* packet, ENetPeer* peer);
+
+  uint64_t GetDropCount(DropReason reason) const { return drops_[reason]; }
+  uint64_t GetDispatchedCount() const { return dispatched_; }
+
+  // Prints the drop counters if anything was dropped since the previous report
+  void ReportDrops(const char* name);
+
+private:
+  struct Entry {
+    Handler handler{nullptr};
+    MessageSizeLimits limits;
+  };
+
+  bool Drop(DropReason reason);
+
+  std::array<Entry, E_MESSAGE_TYPE_COUNT> entries_{};
+  std::array<uint64_t, E_DROP_REASON_COUNT> drops_{};
+  uint64_t dispatched_{0};
+  uint64_t reported_drops_{0};
+};
\ No newline at end of file
@@ -0,0 +1,51 @@
+#include "interest.hpp"
+
+#include <algorithm>
+
+// Queries span at most this many cells per axis
+static constexpr float kCellsPerFarRadius = 4.0f;
+
+InterestManager::InterestManager(const InterestSettings& settings) : settings_(settings) {
+  cell_size_ = std::max(settings_.near_radius, settings_.far_radius / kCellsPerFarRadius);
+}
+
+bool InterestManager::IsFarUpdateDue(uint16_t eid) const {
+  return (eid + tick_) % settings_.far_update_period == 0;
+}
+
+void InterestManager::Update(const std::vector<Entity>& entities) {
+  ++tick_;
+  grid_.Build(entities, cell_size_);
+}
+
+void InterestManager::Gather(const std::vector<Entity>& entities, float x, float y,
+                             std::vector<uint32_t>& out_indices) const {
+  if (entities.empty()) {
+    return;
+  }
+
+  float near_radius_sq = settings_.near_radius * settings_.near_radius;
+  float far_radius_sq = settings_.far_radius * settings_.far_radius;
+
+  size_t first = out_indices.size();
+  grid_.ForEachInRect(x - settings_.far_radius, y - settings_.far_radius, x + settings_.far_radius,
+                      y + settings_.far_radius, [&](uint32_t index) {
+    const Entity& entity = entities[index];
+    float dx = entity.x - x;
+    float dy = entity.y - y;
+    float distance_sq = dx * dx + dy * dy;
+
+    if (distance_sq <= near_radius_sq || (distance_sq <= far_radius_sq && IsFarUpdateDue(entity.eid))) {
+      out_indices.push_back(index);
+    }
+  });
+  std::sort(out_indices.begin() + first, out_indices.end());
+}
+
+void InterestManager::GatherAll(const std::vector<Entity>& entities, std::vector<uint32_t>& out_indices) const {
+  for (uint32_t i = 0; i < entities.size(); ++i) {
+    if (IsFarUpdateDue(entities[i].eid)) {
+      out_indices.push_back(i);
+    }
+  }
+}
\ No newline at end of file
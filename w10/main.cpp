@@ -7,46 +7,67 @@
 
 #include <vector>
 #include "entity.h"
+#include "entity_registry.hpp"
 #include "protocol.h"
+#include "dispatcher.hpp"
 
 
-static std::vector<Entity> entities;
+static EntityRegistry<Entity> entities;
 static uint16_t my_entity = invalid_entity;
 
-void on_new_entity_packet(ENetPacket *packet)
+// Entities outside the area of interest stop getting snapshots, they are hidden once their last one
+// is this old instead of being drawn frozen. A few far update periods, so losses don't make them blink
+constexpr uint32_t kStaleEntityTimeoutMs = 500;
+static EidMap<uint32_t> lastSnapshotTimes;
+
+bool is_stale(const Entity &e, uint32_t curTime)
+{
+  return e.eid != my_entity && curTime - lastSnapshotTimes.Get(e.eid) > kStaleEntityTimeoutMs;
+}
+
+bool on_new_entity_packet(ENetPacket *packet, ENetPeer *)
 {
   Entity newEntity;
-  deserialize_new_entity(packet, newEntity);
-  // TODO: Direct adressing, of course!
-  for (const Entity &e : entities)
-    if (e.eid == newEntity.eid)
-      return; // don't need to do anything, we already have entity
-  entities.push_back(newEntity);
+  if (!deserialize_new_entity(packet, newEntity))
+    return false;
+  if (entities.Contains(newEntity.eid))
+    return true; // don't need to do anything, we already have entity
+  entities.Add(newEntity.eid, newEntity);
+  lastSnapshotTimes[newEntity.eid] = enet_time_get();
+  return true;
 }
 
-void on_set_controlled_entity(ENetPacket *packet)
+bool on_set_controlled_entity(ENetPacket *packet, ENetPeer *)
 {
-  deserialize_set_controlled_entity(packet, my_entity);
+  return deserialize_set_controlled_entity(packet, my_entity);
 }
 
-void on_snapshot(ENetPacket *packet)
+bool on_world_snapshot(ENetPacket *packet, ENetPeer *peer)
 {
-  uint16_t eid = invalid_entity;
-  float x = 0.f; float y = 0.f; float ori = 0.f;
-  deserialize_snapshot(packet, eid, x, y, ori);
-  // TODO: Direct adressing, of course!
-  for (Entity &e : entities)
-    if (e.eid == eid)
+  static std::vector<EntitySnapshot> snapshots;
+  if (!decipher_data(packet, peer) || !deserialize_world_snapshot(packet, snapshots))
+    return false;
+  for (const EntitySnapshot &snapshot : snapshots)
+  {
+    if (Entity *e = entities.Find(snapshot.eid))
     {
-      e.x = x;
-      e.y = y;
-      e.ori = ori;
+      e->x = snapshot.x;
+      e->y = snapshot.y;
+      e->ori = snapshot.ori;
+      lastSnapshotTimes[snapshot.eid] = enet_time_get();
     }
+  }
+  return true;
 }
 
-void on_key(ENetPacket *packet)
+bool on_key(ENetPacket *packet, ENetPeer *peer)
 {
-  deserialize_and_set_key(packet);
+  PeerContext *context = (PeerContext*)peer->data;
+  if (!deserialize_cipher_key(packet, context->key))
+    return false;
+
+  context->hasKey = true;
+  return true;
 }
 
 int main(int argc, const char **argv)
@@ -98,7 +119,14 @@ int main(int argc, const char **argv)
 
   SetTargetFPS(60);               // Set our game to run at 60 frames-per-second
 
+  MessageDispatcher dispatcher;
+  dispatcher.Register(E_SERVER_TO_CLIENT_NEW_ENTITY, on_new_entity_packet);
+  dispatcher.Register(E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY, on_set_controlled_entity);
+  dispatcher.Register(E_SERVER_TO_CLIENT_WORLD_SNAPSHOT, on_world_snapshot);
+  dispatcher.Register(E_SERVER_TO_CLIENT_KEY, on_key);
+
   bool connected = false;
+  uint32_t lastDropReportTime = enet_time_get();
   while (!WindowShouldClose())
   {
     float dt = GetFrameTime();
@@ -109,47 +137,39 @@ int main(int argc, const char **argv)
       {
       case ENET_EVENT_TYPE_CONNECT:
         printf("Connection with %x:%u established\n", event.peer->address.host, event.peer->address.port);
+        event.peer->data = new PeerContext;
         send_join(serverPeer);
         connected = true;
         break;
       case ENET_EVENT_TYPE_RECEIVE:
-        switch (get_packet_type(event.packet))
-        {
-        case E_SERVER_TO_CLIENT_NEW_ENTITY:
-          on_new_entity_packet(event.packet);
-          break;
-        case E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY:
-          on_set_controlled_entity(event.packet);
-          break;
-        case E_SERVER_TO_CLIENT_SNAPSHOT:
-          on_snapshot(event.packet);
-          break;
-        case E_SERVER_TO_CLIENT_KEY:
-          on_key(event.packet);
-          break;
-        };
+        dispatcher.Dispatch(event.packet, event.peer);
+        enet_packet_destroy(event.packet);
         break;
       default:
         break;
       };
     }
+    uint32_t curTime = enet_time_get();
+    if (curTime - lastDropReportTime >= 1000)
+    {
+      dispatcher.ReportDrops("Client");
+      lastDropReportTime = curTime;
+    }
     if (my_entity != invalid_entity)
     {
       bool left = IsKeyDown(KEY_LEFT);
       bool right = IsKeyDown(KEY_RIGHT);
       bool up = IsKeyDown(KEY_UP);
       bool down = IsKeyDown(KEY_DOWN);
-      // TODO: Direct adressing, of course!
-      for (Entity &e : entities)
-        if (e.eid == my_entity)
-        {
-          // Update
-          float thr = (up ? 1.f : 0.f) + (down ? -1.f : 0.f);
-          float steer = (left ? -1.f : 0.f) + (right ? 1.f : 0.f);
+      if (entities.Contains(my_entity))
+      {
+        // Update
+        float thr = (up ? 1.f : 0.f) + (down ? -1.f : 0.f);
+        float steer = (left ? -1.f : 0.f) + (right ? 1.f : 0.f);
 
-          // Send
-          send_entity_input(serverPeer, my_entity, thr, steer);
-        }
+        // Send
+        send_entity_input(serverPeer, my_entity, thr, steer);
+      }
     }
 
     BeginDrawing();
@@ -158,6 +178,8 @@ int main(int argc, const char **argv)
         DrawRectangleLines(-16, -8, 32, 16, GetColor(0xff00ffff));
         for (const Entity &e : entities)
         {
+          if (is_stale(e, curTime))
+            continue;
           const Rectangle rect = {e.x, e.y, 3.f, 1.f};
           DrawRectanglePro(rect, {0.f, 0.5f}, e.ori * 180.f / PI, GetColor(e.color));
         }
@@ -168,5 +190,6 @@ int main(int argc, const char **argv)
   }
 
   CloseWindow();
+  delete (PeerContext*)serverPeer->data;
   return 0;
 }
@@ -1,10 +1,114 @@
 #include "protocol.h"
-#include "quantisation.h"
+#include "serialization.hpp"
+#include "crc32c.hpp"
+#include "mathUtils.h" // PI
+#include <algorithm> // min
 #include <cstring> // memcpy
 #include <iostream>
 #include <stdlib.h>
 
-static uint32_t xorCipherKey = 0;
+// Wire layouts of the messages, each packet is a MessageType followed by its message schema
+struct ControlledEntityMessage
+{
+  uint16_t eid = invalid_entity;
+};
+
+struct CipherKeyMessage
+{
+  CipherKey key;
+};
+
+struct EntityInputMessage
+{
+  uint16_t eid = invalid_entity;
+  float thr = 0.f;
+  float steer = 0.f;
+};
+
+using NewEntitySchema = Schema<Field<&Entity::color>,
+                               QuantizedField<&Entity::x, Range{-16.f, 16.f}, 16>,
+                               QuantizedField<&Entity::y, Range{-8.f, 8.f}, 16>,
+                               QuantizedField<&Entity::ori, Range{-PI, PI}, 16>,
+                               Field<&Entity::eid>>;
+using ControlledEntitySchema = Schema<Field<&ControlledEntityMessage::eid>>;
+using CipherKeySchema = Schema<Field<&CipherKeyMessage::key>>;
+// Controls are -1, 0 or 1, all of them are exact
+using EntityInputSchema = Schema<Field<&EntityInputMessage::eid>,
+                                 QuantizedField<&EntityInputMessage::thr, Range{-1.f, 1.f}, 4>,
+                                 QuantizedField<&EntityInputMessage::steer, Range{-1.f, 1.f}, 4>>;
+using EntitySnapshotSchema = Schema<Field<&EntitySnapshot::eid>,
+                                    QuantizedField<&EntitySnapshot::x, Range{-16.f, 16.f}, 11>,
+                                    QuantizedField<&EntitySnapshot::y, Range{-8.f, 8.f}, 10>,
+                                    QuantizedField<&EntitySnapshot::ori, Range{-PI, PI}, 8>>;
+
+static_assert(NewEntitySchema::kBytes == 12);
+static_assert(ControlledEntitySchema::kBytes == 2);
+static_assert(CipherKeySchema::kBytes == 32);
+static_assert(EntityInputSchema::kBytes == 3);
+static_assert(EntitySnapshotSchema::kBits == 45);
+
+// Encrypted messages carry the sender's packet sequence in the clear after the type, it is their nonce.
+// They end with CRC32C of the header and the ciphertext, packets corrupted on the way are rejected.
+// A checksum of the plaintext sent in the clear would let a 24-bit input be brute forced from it.
+static constexpr size_t kPlainHeaderSize = sizeof(MessageType);
+static constexpr size_t kCipherHeaderSize = sizeof(MessageType) + sizeof(uint32_t);
+static constexpr size_t kCipherTrailerSize = sizeof(uint32_t);
+
+template<typename MessageSchema, size_t HeaderSize = kPlainHeaderSize, size_t TrailerSize = 0, typename T>
+static ENetPacket *create_message_packet(MessageType type, const T &message, uint32_t flags)
+{
+  ENetPacket *packet = enet_packet_create(nullptr, HeaderSize + MessageSchema::kBytes + TrailerSize, flags);
+  *packet->data = type;
+  Bitstream bitstream = Bitstream::Wrap(packet->data + HeaderSize, MessageSchema::kBytes);
+  MessageSchema::Write(bitstream, message);
+  return packet;
+}
+
+template<typename MessageSchema, size_t HeaderSize = kPlainHeaderSize, size_t TrailerSize = 0>
+constexpr MessageSizeLimits kFixedMessageSize = {HeaderSize + MessageSchema::kBytes + TrailerSize,
+                                                 HeaderSize + MessageSchema::kBytes + TrailerSize};
+
+template<typename MessageSchema, size_t HeaderSize = kPlainHeaderSize, size_t TrailerSize = 0, typename T>
+static bool read_message(ENetPacket *packet, T &message)
+{
+  if (packet->dataLength != HeaderSize + MessageSchema::kBytes + TrailerSize)
+    return false;
+
+  Bitstream bitstream{packet->data + HeaderSize, MessageSchema::kBytes};
+  MessageSchema::Read(bitstream, message);
+  return true;
+}
+
+static constexpr size_t kWorldSnapshotHeaderSize = kCipherHeaderSize + sizeof(uint16_t);
+
+static uint64_t get_nonce(ENetPacket *packet, uint32_t sequence)
+{
+  // Types only go one way, so the two directions never share a nonce
+  return uint64_t(*packet->data) << 32 | sequence;
+}
+
+static PeerContext *get_peer_context(ENetPeer *peer)
+{
+  return static_cast<PeerContext*>(peer->data);
+}
+
+// Stamps the packet with the sequence used as nonce, encrypts the payload between the cipher header
+// and trailer and fills the trailer with the integrity tag
+static bool cipher_data(ENetPacket *packet, ENetPeer *peer)
+{
+  PeerContext *context = get_peer_context(peer);
+  if (context == nullptr || !context->hasKey || packet->dataLength < kCipherHeaderSize + kCipherTrailerSize)
+    return false;
+
+  uint32_t sequence = context->sendSequence++;
+  memcpy(packet->data + sizeof(MessageType), &sequence, sizeof(sequence));
+
+  uint32_t tag = crc32c(0, packet->data, kCipherHeaderSize);
+  tag = chacha20_xor_crc32c(context->key, get_nonce(packet, sequence), packet->data + kCipherHeaderSize,
+                            packet->dataLength - kCipherHeaderSize - kCipherTrailerSize, true, tag);
+  memcpy(packet->data + packet->dataLength - kCipherTrailerSize, &tag, sizeof(tag));
+  return true;
+}
 
 void send_join(ENetPeer *peer)
 {
@@ -16,165 +120,187 @@ void send_join(ENetPeer *peer)
 
 void send_new_entity(ENetPeer *peer, const Entity &ent)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(Entity),
-                                                   ENET_PACKET_FLAG_RELIABLE);
-  uint8_t *ptr = packet->data;
-  *ptr = E_SERVER_TO_CLIENT_NEW_ENTITY; ptr += sizeof(uint8_t);
-  memcpy(ptr, &ent, sizeof(Entity)); ptr += sizeof(Entity);
-
+  ENetPacket *packet = create_message_packet<NewEntitySchema>(E_SERVER_TO_CLIENT_NEW_ENTITY, ent,
+                                                              ENET_PACKET_FLAG_RELIABLE);
   enet_peer_send(peer, 0, packet);
 }
 
-void send_set_controlled_entity(ENetPeer *peer, uint16_t eid)
+void broadcast_new_entity(ENetHost *host, const Entity &ent)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t),
-                                                   ENET_PACKET_FLAG_RELIABLE);
-  uint8_t *ptr = packet->data;
-  *ptr = E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY; ptr += sizeof(uint8_t);
-  memcpy(ptr, &eid, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+  ENetPacket *packet = create_message_packet<NewEntitySchema>(E_SERVER_TO_CLIENT_NEW_ENTITY, ent,
+                                                              ENET_PACKET_FLAG_RELIABLE);
+  enet_host_broadcast(host, 0, packet);
+}
 
+void send_set_controlled_entity(ENetPeer *peer, uint16_t eid)
+{
+  ENetPacket *packet = create_message_packet<ControlledEntitySchema>(E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY,
+                                                                     ControlledEntityMessage{eid},
+                                                                     ENET_PACKET_FLAG_RELIABLE);
   enet_peer_send(peer, 0, packet);
 }
 
-void send_cipher_key(ENetPeer *peer, uint32_t key)
+void send_cipher_key(ENetPeer *peer, const CipherKey &key)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint32_t),
-                                                   ENET_PACKET_FLAG_RELIABLE);
-  uint8_t *ptr = packet->data;
-  *ptr = E_SERVER_TO_CLIENT_KEY; ptr += sizeof(uint8_t);
-  memcpy(ptr, &key, sizeof(uint32_t)); ptr += sizeof(uint32_t);
-
+  ENetPacket *packet = create_message_packet<CipherKeySchema>(E_SERVER_TO_CLIENT_KEY, CipherKeyMessage{key},
+                                                              ENET_PACKET_FLAG_RELIABLE);
   enet_peer_send(peer, 0, packet);
 }
 
+// One input in this many is corrupted on the way, rarely enough to keep the player in control
+static constexpr int kInputFuzzPeriod = 16;
+
 void fuzz_packet_data(ENetPacket *packet)
 {
   packet->data[rand() % packet->dataLength] = (uint8_t)rand();
 }
 
-void send_entity_input(ENetPeer *peer, uint16_t eid, float thr, float ori)
-{
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t) +
-                                                   sizeof(float) * 2,
-                                                   //sizeof(uint8_t),
-                                                   ENET_PACKET_FLAG_UNSEQUENCED);
-  uint8_t *ptr = packet->data;
-  *ptr = E_CLIENT_TO_SERVER_INPUT; ptr += sizeof(uint8_t);
-  memcpy(ptr, &eid, sizeof(uint16_t)); ptr += sizeof(uint16_t);
-  memcpy(ptr, &thr, sizeof(float)); ptr += sizeof(float);
-  memcpy(ptr, &ori, sizeof(float)); ptr += sizeof(float);
-  /*
-  float4bitsQuantized thrPacked(thr, -1.f, 1.f);
-  float4bitsQuantized oriPacked(ori, -1.f, 1.f);
-  uint8_t thrSteerPacked = (thrPacked.packedVal << 4) | oriPacked.packedVal;
-  memcpy(ptr, &thrSteerPacked, sizeof(uint8_t)); ptr += sizeof(uint8_t);
-  */
-  /*
-  memcpy(ptr, &thrPacked, sizeof(uint8_t)); ptr += sizeof(uint8_t);
-  memcpy(ptr, &oriPacked, sizeof(uint8_t)); ptr += sizeof(uint8_t);
-  */
-
-  fuzz_packet_data(packet);
-  cipher_data(packet);
+void send_entity_input(ENetPeer *peer, uint16_t eid, float thr, float steer)
+{
+  ENetPacket *packet = create_message_packet<EntityInputSchema, kCipherHeaderSize, kCipherTrailerSize>(
+    E_CLIENT_TO_SERVER_INPUT, EntityInputMessage{eid, thr, steer}, ENET_PACKET_FLAG_UNSEQUENCED);
+
+  if (!cipher_data(packet, peer))
+  {
+    enet_packet_destroy(packet);
+    return;
+  }
+  // Corruption on the way, the server has to reject it by the tag
+  if (rand() % kInputFuzzPeriod == 0)
+    fuzz_packet_data(packet);
 
   enet_peer_send(peer, 1, packet);
 }
 
-void send_snapshot(ENetPeer *peer, uint16_t eid, float x, float y, float ori)
-{
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t) +
-                                                   sizeof(uint16_t) +
-                                                   sizeof(uint16_t) +
-                                                   sizeof(uint8_t),
-                                                   ENET_PACKET_FLAG_UNSEQUENCED);
-  uint8_t *ptr = packet->data;
-  *ptr = E_SERVER_TO_CLIENT_SNAPSHOT; ptr += sizeof(uint8_t);
-  memcpy(ptr, &eid, sizeof(uint16_t)); ptr += sizeof(uint16_t);
-  uint16_t xPacked = pack_float<uint16_t>(x, -16.f, 16.f, 11);
-  uint16_t yPacked = pack_float<uint16_t>(y, -8.f, 8.f, 10);
-  uint8_t oriPacked = pack_float<uint8_t>(ori, -PI, PI, 8);
-  //printf("xPacked/unpacked %d %f\n", xPacked, x);
-  memcpy(ptr, &xPacked, sizeof(uint16_t)); ptr += sizeof(uint16_t);
-  memcpy(ptr, &yPacked, sizeof(uint16_t)); ptr += sizeof(uint16_t);
-  memcpy(ptr, &oriPacked, sizeof(uint8_t)); ptr += sizeof(uint8_t);
+void send_world_snapshot(ENetPeer *peer, const std::vector<EntitySnapshot> &snapshots)
+{
+  constexpr size_t kHeaderSize = kWorldSnapshotHeaderSize;
+  constexpr size_t kMaxRecords = (kMaxWorldSnapshotPacketSize - kHeaderSize - kCipherTrailerSize) * 8 /
+                                 EntitySnapshotSchema::kBits;
 
-  enet_peer_send(peer, 1, packet);
+  for (size_t first = 0; first < snapshots.size(); first += kMaxRecords)
+  {
+    uint16_t count = std::min(kMaxRecords, snapshots.size() - first);
+
+    size_t recordsSize = (count * EntitySnapshotSchema::kBits + 7) / 8;
+    ENetPacket *packet = enet_packet_create(nullptr, kHeaderSize + recordsSize + kCipherTrailerSize,
+                                                     ENET_PACKET_FLAG_UNSEQUENCED);
+    *packet->data = E_SERVER_TO_CLIENT_WORLD_SNAPSHOT;
+    Bitstream bitstream = Bitstream::Wrap(packet->data + kCipherHeaderSize,
+                                          packet->dataLength - kCipherHeaderSize - kCipherTrailerSize);
+    bitstream.Write(count);
+    for (size_t i = first; i < first + count; ++i)
+      EntitySnapshotSchema::Write(bitstream, snapshots[i]);
+
+    if (!cipher_data(packet, peer))
+    {
+      enet_packet_destroy(packet);
+      return;
+    }
+
+    enet_peer_send(peer, 1, packet);
+  }
 }
 
 MessageType get_packet_type(ENetPacket *packet)
 {
+  if (packet->dataLength == 0 || *packet->data >= E_MESSAGE_TYPE_COUNT)
+    return E_MESSAGE_TYPE_COUNT;
   return (MessageType)*packet->data;
 }
 
-void deserialize_new_entity(ENetPacket *packet, Entity &ent)
+MessageSizeLimits get_message_size_limits(MessageType type)
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
-  ent = *(Entity*)(ptr); ptr += sizeof(Entity);
+  switch (type)
+  {
+    case E_CLIENT_TO_SERVER_JOIN:
+      return {sizeof(MessageType), sizeof(MessageType)};
+    case E_SERVER_TO_CLIENT_NEW_ENTITY:
+      return kFixedMessageSize<NewEntitySchema>;
+    case E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY:
+      return kFixedMessageSize<ControlledEntitySchema>;
+    case E_CLIENT_TO_SERVER_INPUT:
+      return kFixedMessageSize<EntityInputSchema, kCipherHeaderSize, kCipherTrailerSize>;
+    case E_SERVER_TO_CLIENT_WORLD_SNAPSHOT:
+      return {kWorldSnapshotHeaderSize + kCipherTrailerSize, kMaxWorldSnapshotPacketSize};
+    case E_SERVER_TO_CLIENT_KEY:
+      return kFixedMessageSize<CipherKeySchema>;
+    default:
+      return {};
+  }
 }
 
-void deserialize_set_controlled_entity(ENetPacket *packet, uint16_t &eid)
+bool deserialize_new_entity(ENetPacket *packet, Entity &ent)
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
-  eid = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
+  ent = Entity{};
+  return read_message<NewEntitySchema>(packet, ent);
 }
 
-void xor_packet_data(ENetPacket *packet, uint8_t *key_ptr)
+bool deserialize_set_controlled_entity(ENetPacket *packet, uint16_t &eid)
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
-  uint8_t *end = packet->data + packet->dataLength;
-  for (int i = 0; ptr < end; ++ptr, ++i)
-  {
-    i = i % 4;
-    *ptr ^= key_ptr[i];
-  }
-}
+  ControlledEntityMessage message;
+  if (!read_message<ControlledEntitySchema>(packet, message))
+    return false;
 
-void cipher_data(ENetPacket *packet)
-{
-  xor_packet_data(packet, (uint8_t*)&xorCipherKey);
+  eid = message.eid;
+  return true;
 }
 
-void decipher_data(ENetPacket *packet, ENetPeer *peer)
+bool decipher_data(ENetPacket *packet, ENetPeer *peer)
 {
-  xor_packet_data(packet, (uint8_t*)peer->data);
+  PeerContext *context = get_peer_context(peer);
+  if (context == nullptr || !context->hasKey || packet->dataLength < kCipherHeaderSize + kCipherTrailerSize)
+    return false;
+
+  uint32_t sequence = 0;
+  uint32_t expectedTag = 0;
+  memcpy(&sequence, packet->data + sizeof(MessageType), sizeof(sequence));
+  memcpy(&expectedTag, packet->data + packet->dataLength - kCipherTrailerSize, sizeof(expectedTag));
+
+  uint32_t tag = crc32c(0, packet->data, kCipherHeaderSize);
+  tag = chacha20_xor_crc32c(context->key, get_nonce(packet, sequence), packet->data + kCipherHeaderSize,
+                            packet->dataLength - kCipherHeaderSize - kCipherTrailerSize, false, tag);
+  return tag == expectedTag;
 }
 
-void deserialize_entity_input(ENetPacket *packet, uint16_t &eid, float &thr, float &steer)
+bool deserialize_entity_input(ENetPacket *packet, uint16_t &eid, float &thr, float &steer)
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
+  EntityInputMessage message;
+  if (!read_message<EntityInputSchema, kCipherHeaderSize, kCipherTrailerSize>(packet, message))
+    return false;
 
-  eid = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
-  thr = *(float*)(ptr); ptr += sizeof(float);
-  steer = *(float*)(ptr); ptr += sizeof(float);
-  //uint8_t thrSteerPacked = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
-  /*
-  uint8_t thrPacked = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
-  uint8_t oriPacked = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
-  */
-  /*
-  static uint8_t neutralPackedValue = pack_float<uint8_t>(0.f, -1.f, 1.f, 4);
-  float4bitsQuantized thrPacked(thrSteerPacked >> 4);
-  float4bitsQuantized steerPacked(thrSteerPacked & 0x0f);
-  thr = thrPacked.packedVal == neutralPackedValue ? 0.f : thrPacked.unpack(-1.f, 1.f);
-  steer = steerPacked.packedVal == neutralPackedValue ? 0.f : steerPacked.unpack(-1.f, 1.f);
-  */
+  eid = message.eid;
+  thr = message.thr;
+  steer = message.steer;
+  return true;
 }
 
-void deserialize_snapshot(ENetPacket *packet, uint16_t &eid, float &x, float &y, float &ori)
+bool deserialize_world_snapshot(ENetPacket *packet, std::vector<EntitySnapshot> &snapshots)
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
-  eid = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
-  uint16_t xPacked = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
-  uint16_t yPacked = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
-  uint8_t oriPacked = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
-  x = unpack_float<uint16_t>(xPacked, -16.f, 16.f, 11);
-  y = unpack_float<uint16_t>(yPacked, -8.f, 8.f, 10);
-  ori = unpack_float<uint8_t>(oriPacked, -PI, PI, 8);
+  snapshots.clear();
+  if (packet->dataLength < kWorldSnapshotHeaderSize + kCipherTrailerSize)
+    return false;
+
+  Bitstream bitstream{packet->data + kCipherHeaderSize, packet->dataLength - kCipherHeaderSize - kCipherTrailerSize};
+
+  uint16_t count = 0;
+  bitstream.Read(count);
+  if (packet->dataLength != kWorldSnapshotHeaderSize + (count * EntitySnapshotSchema::kBits + 7) / 8 + kCipherTrailerSize)
+    return false;
+
+  snapshots.resize(count);
+  for (EntitySnapshot &snapshot : snapshots)
+    EntitySnapshotSchema::Read(bitstream, snapshot);
+  return true;
 }
 
-void deserialize_and_set_key(ENetPacket *packet)
+bool deserialize_cipher_key(ENetPacket *packet, CipherKey &key)
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
-  xorCipherKey = *(uint32_t*)(ptr); ptr += sizeof(uint32_t);
+  CipherKeyMessage message;
+  if (!read_message<CipherKeySchema>(packet, message))
+    return false;
+
+  key = message.key;
+  return true;
 }
 
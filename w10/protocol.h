@@ -1,7 +1,9 @@
 #pragma once
 #include <enet/enet.h>
 #include <cstdint>
+#include <vector>
 #include "entity.h"
+#include "cipher.hpp"
 
 enum MessageType : uint8_t
 {
@@ -9,25 +11,52 @@ enum MessageType : uint8_t
   E_SERVER_TO_CLIENT_NEW_ENTITY,
   E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY,
   E_CLIENT_TO_SERVER_INPUT,
-  E_SERVER_TO_CLIENT_SNAPSHOT,
-  E_SERVER_TO_CLIENT_KEY
+  E_SERVER_TO_CLIENT_WORLD_SNAPSHOT,
+  E_SERVER_TO_CLIENT_KEY,
+  E_MESSAGE_TYPE_COUNT
 };
 
+// Kept in ENetPeer::data on both sides
+struct PeerContext
+{
+  CipherKey key;
+  bool hasKey = false;
+  // Sequence of the next encrypted packet sent to the peer, used as the nonce
+  uint32_t sendSequence = 0;
+};
+
+// Sizes a packet of the type can have, MessageType included. Packets outside of them are malformed.
+struct MessageSizeLimits
+{
+  size_t min = 0;
+  size_t max = 0;
+};
+
+// World snapshots are split so that every packet fits into ENet's default MTU (1400)
+constexpr size_t kMaxWorldSnapshotPacketSize = 1200;
+
 void send_join(ENetPeer *peer);
 void send_new_entity(ENetPeer *peer, const Entity &ent);
+// Encodes the message once and shares the packet between all connected peers
+void broadcast_new_entity(ENetHost *host, const Entity &ent);
 void send_set_controlled_entity(ENetPeer *peer, uint16_t eid);
-void send_cipher_key(ENetPeer *peer, uint32_t key);
+void send_cipher_key(ENetPeer *peer, const CipherKey &key);
+// Inputs and world snapshots are encrypted with the peer's key, nothing is sent before it is known
 void send_entity_input(ENetPeer *peer, uint16_t eid, float thr, float steer);
-void send_snapshot(ENetPeer *peer, uint16_t eid, float x, float y, float ori);
+void send_world_snapshot(ENetPeer *peer, const std::vector<EntitySnapshot> &snapshots);
 
+// E_MESSAGE_TYPE_COUNT for empty packets
 MessageType get_packet_type(ENetPacket *packet);
+MessageSizeLimits get_message_size_limits(MessageType type);
 
-void deserialize_new_entity(ENetPacket *packet, Entity &ent);
-void deserialize_set_controlled_entity(ENetPacket *packet, uint16_t &eid);
-void deserialize_entity_input(ENetPacket *packet, uint16_t &eid, float &thr, float &steer);
-void deserialize_snapshot(ENetPacket *packet, uint16_t &eid, float &x, float &y, float &ori);
-void deserialize_and_set_key(ENetPacket *packet);
+// Packets are parsed in place, deserialize_* return false for malformed ones
+bool deserialize_new_entity(ENetPacket *packet, Entity &ent);
+bool deserialize_set_controlled_entity(ENetPacket *packet, uint16_t &eid);
+bool deserialize_entity_input(ENetPacket *packet, uint16_t &eid, float &thr, float &steer);
+bool deserialize_world_snapshot(ENetPacket *packet, std::vector<EntitySnapshot> &snapshots);
+bool deserialize_cipher_key(ENetPacket *packet, CipherKey &key);
 
-void cipher_data(ENetPacket *packet);
-void decipher_data(ENetPacket *packet, ENetPeer *peer);
+// Decrypts an inputs or world snapshot packet in place and checks its integrity tag, false if the
+// peer's key isn't known yet or the packet was corrupted
+bool decipher_data(ENetPacket *packet, ENetPeer *peer);
 
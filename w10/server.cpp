@@ -1,26 +1,39 @@
 #include <enet/enet.h>
 #include <iostream>
 #include "entity.h"
+#include "entity_registry.hpp"
 #include "protocol.h"
+#include "packet_pool.hpp"
 #include "mathUtils.h"
+#include "interest.hpp"
+#include "dispatcher.hpp"
 #include <stdlib.h>
 #include <vector>
-#include <map>
 #include <random>
 
-static std::vector<Entity> entities;
-static std::map<uint16_t, ENetPeer*> controlledMap;
+static EntityRegistry<Entity> entities;
+// Peer controlling each entity
+static EidMap<ENetPeer*> controlledMap;
+// Entity controlled by each peer, indexed as host->peers
+static std::vector<EntityHandle> peerEntities;
 
-void on_join(ENetPacket *packet, ENetPeer *peer, ENetHost *host)
+// Everything on screen around the player is updated every tick, the rest of the map every 4th tick.
+// The client's camera is fixed and shows the whole 32x16 map, the far radius is just over its diagonal
+// so nothing on the map is culled until a car drives well off it
+constexpr InterestSettings kInterestSettings = {10.f, 40.f, 4};
+
+bool on_join(ENetPacket *packet, ENetPeer *peer)
 {
+  ENetHost *host = peer->host;
+
   // send all entities
   for (const Entity &ent : entities)
     send_new_entity(peer, ent);
 
   // find max eid
-  uint16_t maxEid = entities.empty() ? invalid_entity : entities[0].eid;
-  for (const Entity &e : entities)
-    maxEid = std::max(maxEid, e.eid);
+  uint16_t maxEid = entities.Empty() ? invalid_entity : entities.Eids()[0];
+  for (uint16_t eid : entities.Eids())
+    maxEid = std::max(maxEid, eid);
   uint16_t newEid = maxEid + 1;
   uint32_t color = 0xff000000 +
                    0x00440000 * (rand() % 5) +
@@ -29,40 +42,53 @@ void on_join(ENetPacket *packet, ENetPeer *peer, ENetHost *host)
   float x = (rand() % 4) * 2.f;
   float y = (rand() % 4) * 2.f;
   Entity ent = {color, x, y, 0.f, (rand() / RAND_MAX) * 3.141592654f, 0.f, 0.f, newEid};
-  entities.push_back(ent);
+  entities.Add(newEid, ent);
 
   controlledMap[newEid] = peer;
+  peerEntities[peer - host->peers] = entities.GetHandle(newEid);
 
 
   // send info about new entity to everyone
-  for (size_t i = 0; i < host->peerCount; ++i)
-    send_new_entity(&host->peers[i], ent);
+  broadcast_new_entity(host, ent);
   // send info about controlled entity
   send_set_controlled_entity(peer, newEid);
-  uint32_t *keyPtr = (uint32_t*)peer->data;
+  PeerContext *context = (PeerContext*)peer->data;
   std::random_device rd;  //Will be used to obtain a seed for the random number engine
   std::mt19937 gen(rd()); //Standard mersenne_twister_engine seeded with rd()
   std::uniform_int_distribution<uint32_t> distrib(0);
-  *keyPtr = distrib(gen);
-  send_cipher_key(peer, *keyPtr);
+  for (uint32_t &word : context->key.words)
+    word = distrib(gen);
+  context->hasKey = true;
+  send_cipher_key(peer, context->key);
+  return true;
 }
 
-void on_input(ENetPacket *packet)
+bool on_input(ENetPacket *packet, ENetPeer *peer)
 {
+  if (!decipher_data(packet, peer))
+    return false;
+
   uint16_t eid = invalid_entity;
   float thr = 0.f; float steer = 0.f;
-  deserialize_entity_input(packet, eid, thr, steer);
-  for (Entity &e : entities)
-    if (e.eid == eid)
-    {
-      e.thr = thr;
-      e.steer = steer;
-    }
+  if (!deserialize_entity_input(packet, eid, thr, steer))
+    return false;
+
+  // Peers only steer the entity they control
+  if (controlledMap.Get(eid) != peer)
+    return false;
+
+  if (Entity *e = entities.Find(eid))
+  {
+    e->thr = thr;
+    e->steer = steer;
+  }
+  return true;
 }
 
 int main(int argc, const char **argv)
 {
-  if (enet_initialize() != 0)
+  // Snapshots allocate packets for every peer every tick, they are recycled instead of malloc'ed
+  if (enet_initialize_with_packet_pool() != 0)
   {
     printf("Cannot init ENet");
     return 1;
@@ -80,7 +106,14 @@ int main(int argc, const char **argv)
     return 1;
   }
 
+  peerEntities.resize(server->peerCount);
+
+  MessageDispatcher dispatcher;
+  dispatcher.Register(E_CLIENT_TO_SERVER_JOIN, on_join);
+  dispatcher.Register(E_CLIENT_TO_SERVER_INPUT, on_input);
+
   uint32_t lastTime = enet_time_get();
+  uint32_t lastDropReportTime = lastTime;
   while (true)
   {
     uint32_t curTime = enet_time_get();
@@ -93,43 +126,64 @@ int main(int argc, const char **argv)
       {
       case ENET_EVENT_TYPE_CONNECT:
         printf("Connection with %x:%u established\n", event.peer->address.host, event.peer->address.port);
-        event.peer->data = new uint32_t;
-        *(uint32_t*)event.peer->data = 0;
+        event.peer->data = new PeerContext;
         break;
       case ENET_EVENT_TYPE_DISCONNECT:
         printf("Disconnected %x:%u \n", event.peer->address.host, event.peer->address.port);
-        delete event.peer->data;
+        delete (PeerContext*)event.peer->data;
+        event.peer->data = nullptr;
         break;
       case ENET_EVENT_TYPE_RECEIVE:
-        switch (get_packet_type(event.packet))
-        {
-          case E_CLIENT_TO_SERVER_JOIN:
-            on_join(event.packet, event.peer, server);
-            break;
-          case E_CLIENT_TO_SERVER_INPUT:
-            decipher_data(event.packet, event.peer);
-            on_input(event.packet);
-            break;
-        };
+        dispatcher.Dispatch(event.packet, event.peer);
         enet_packet_destroy(event.packet);
         break;
       default:
         break;
       };
     }
-    static int t = 0;
+    if (curTime - lastDropReportTime >= 10000)
+    {
+      dispatcher.ReportDrops("Server");
+      lastDropReportTime = curTime;
+    }
+
     for (Entity &e : entities)
     {
       // simulate
       simulate_entity(e, dt);
-      // send
-      for (size_t i = 0; i < server->peerCount; ++i)
+    }
+
+    static InterestManager interest(kInterestSettings);
+    interest.Update(entities.Values());
+
+    // send
+    static std::vector<uint32_t> visible;
+    static std::vector<EntitySnapshot> snapshots;
+    for (size_t i = 0; i < server->peerCount; ++i)
+    {
+      ENetPeer *peer = &server->peers[i];
+      // Snapshots are personalised, nothing is encoded for empty slots
+      if (peer->state != ENET_PEER_STATE_CONNECTED)
+        continue;
+
+      const Entity *viewer = entities.Find(peerEntities[i]);
+
+      visible.clear();
+      if (viewer != nullptr)
+        interest.Gather(entities.Values(), viewer->x, viewer->y, visible);
+      else
+        interest.GatherAll(entities.Values(), visible);
+
+      // skip this here in this implementation
+      //if (controlledMap[e.eid] != peer)
+      snapshots.clear();
+      for (uint32_t idx : visible)
       {
-        ENetPeer *peer = &server->peers[i];
-        // skip this here in this implementation
-        //if (controlledMap[e.eid] != peer)
-        send_snapshot(peer, e.eid, e.x, e.y, e.ori);
+        const Entity &e = entities.Values()[idx];
+        snapshots.push_back({e.eid, e.x, e.y, e.ori});
       }
+
+      send_world_snapshot(peer, snapshots);
     }
     usleep(10000);
   }
@@ -0,0 +1,41 @@
+#include "spatial_hash.hpp"
+
+#include <cmath>
+
+int32_t SpatialHash::GetCellCoord(float coord) const {
+  return static_cast<int32_t>(std::floor(coord * inv_cell_size_));
+}
+
+uint32_t SpatialHash::GetBucket(int32_t cell_x, int32_t cell_y) const {
+  uint32_t hash = static_cast<uint32_t>(cell_x) * 73856093u ^ static_cast<uint32_t>(cell_y) * 19349663u;
+  return hash & bucket_mask_;
+}
+
+void SpatialHash::Build(const std::vector<Entity>& entities, float cell_size) {
+  inv_cell_size_ = 1.0f / cell_size;
+
+  // Twice as many buckets as entities keeps hash collisions rare
+  uint32_t bucket_count = 1;
+  while (bucket_count < 2 * entities.size()) {
+    bucket_count *= 2;
+  }
+  bucket_mask_ = bucket_count - 1;
+
+  bucket_start_.assign(bucket_count + 1, 0);
+  entity_bucket_.resize(entities.size());
+  entity_order_.resize(entities.size());
+
+  // Counting sort of entities by bucket
+  for (uint32_t i = 0; i < entities.size(); ++i) {
+    entity_bucket_[i] = GetBucket(GetCellCoord(entities[i].x), GetCellCoord(entities[i].y));
+    ++bucket_start_[entity_bucket_[i]];
+  }
+
+  for (uint32_t bucket = 1; bucket <= bucket_count; ++bucket) {
+    bucket_start_[bucket] += bucket_start_[bucket - 1];
+  }
+
+  for (uint32_t i = static_cast<uint32_t>(entities.size()); i-- > 0;) {
+    entity_order_[--bucket_start_[entity_bucket_[i]]] = i;
+  }
+}
\ No newline at end of file
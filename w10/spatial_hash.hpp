@@ -0,0 +1,61 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "entity.h"
+
+// Uniform grid over entity positions. Cells are hashed into a flat table with twice as many buckets
+// as entities, which is rebuilt from scratch with a counting sort on every Build.
+class SpatialHash {
+public:
+  void Build(const std::vector<Entity>& entities, float cell_size);
+
+  int32_t GetCellCoord(float coord) const;
+
+  // Calls func(index) once for every entity in cells [min_cell_x, max_cell_x] x [min_cell_y, max_cell_y].
+  // Entities of other cells sharing a bucket with these are reported as well, callers filter by position.
+  template <typename Func>
+  void ForEachInCells(int32_t min_cell_x, int32_t min_cell_y, int32_t max_cell_x, int32_t max_cell_y,
+                      Func&& func) const {
+    if (bucket_start_.empty()) {
+      return;
+    }
+
+    // Different cells may share a bucket, every bucket has to be scanned once
+    static thread_local std::vector<uint32_t> buckets;
+    buckets.clear();
+    for (int32_t cell_y = min_cell_y; cell_y <= max_cell_y; ++cell_y) {
+      for (int32_t cell_x = min_cell_x; cell_x <= max_cell_x; ++cell_x) {
+        uint32_t bucket = GetBucket(cell_x, cell_y);
+        if (std::find(buckets.begin(), buckets.end(), bucket) == buckets.end()) {
+          buckets.push_back(bucket);
+        }
+      }
+    }
+
+    for (uint32_t bucket : buckets) {
+      for (uint32_t i = bucket_start_[bucket]; i < bucket_start_[bucket + 1]; ++i) {
+        func(entity_order_[i]);
+      }
+    }
+  }
+
+  // Same for all cells overlapping the rectangle
+  template <typename Func>
+  void ForEachInRect(float min_x, float min_y, float max_x, float max_y, Func&& func) const {
+    ForEachInCells(GetCellCoord(min_x), GetCellCoord(min_y), GetCellCoord(max_x), GetCellCoord(max_y), func);
+  }
+
+private:
+  uint32_t GetBucket(int32_t cell_x, int32_t cell_y) const;
+
+  float inv_cell_size_{1.0f};
+  uint32_t bucket_mask_{0};
+
+  // Entities of bucket b are entity_order_[bucket_start_[b]..bucket_start_[b + 1])
+  std::vector<uint32_t> bucket_start_;
+  std::vector<uint32_t> entity_order_;
+  std::vector<uint32_t> entity_bucket_;
+};
\ No newline at end of file
@@ -2,57 +2,153 @@
 
 #include <cassert>
 
-Bitstream::Bitstream(const void* data, size_t size) {
-  data_ = new uint8_t[size];
-  capacity_ = size;
-  write_offset_ = capacity_;
+static constexpr size_t kMinCapacity = 64;
 
-  std::memcpy(data_, data, size);
+static size_t BitsToBytes(size_t num_bits) {
+  return (num_bits + 7) / 8;
 }
 
+Bitstream::Bitstream(const void* data, size_t size)
+  : Bitstream(static_cast<uint8_t*>(const_cast<void*>(data)), size, size, true) {}
+
+Bitstream::Bitstream(uint8_t* data, size_t capacity, size_t size, bool read_only)
+  : data_(data), capacity_(capacity), owns_data_(false), read_only_(read_only), write_bit_(size * 8) {}
+
 Bitstream::~Bitstream() {
-  if (data_ != nullptr) {
+  if (owns_data_ && data_ != nullptr) {
     delete[] data_;
   }
 
   data_ = nullptr;
   capacity_ = 0;
-  read_offset_ = 0;
-  write_offset_ = 0;
+  read_bit_ = 0;
+  write_bit_ = 0;
+}
+
+Bitstream Bitstream::Wrap(void* buffer, size_t capacity) {
+  return Bitstream(static_cast<uint8_t*>(buffer), capacity, 0, false);
 }
 
 size_t Bitstream::Size() const {
-  assert(write_offset_ >= read_offset_);
-  return write_offset_ - read_offset_;
+  assert(write_bit_ >= read_bit_);
+  return BitsToBytes(write_bit_) - read_bit_ / 8;
 }
 
-void Bitstream::Write(const void* data, size_t size) {
-  assert(data);
+const uint8_t* Bitstream::Data() const {
+  return data_ + read_bit_ / 8;
+}
+
+void Bitstream::Reset() {
+  assert(!read_only_);
+  read_bit_ = 0;
+  write_bit_ = 0;
+}
+
+void Bitstream::Reserve(size_t capacity) {
+  if (capacity <= capacity_) {
+    return;
+  }
+
+  assert(owns_data_ && "Bitstream over an external buffer cannot grow");
 
-  if (write_offset_ + size > capacity_) {
-    uint8_t* new_data = new uint8_t[write_offset_ + size];
+  uint8_t* new_data = new uint8_t[capacity];
+  if (data_ != nullptr) {
+    std::memcpy(new_data, data_, BitsToBytes(write_bit_));
+    delete[] data_;
+  }
 
-    if (data_ != nullptr) {
-      std::memcpy(new_data, data_, write_offset_);
+  data_ = new_data;
+  capacity_ = capacity;
+}
+
+void Bitstream::EnsureCapacity(size_t num_bits) {
+  assert(!read_only_);
+
+  size_t required = BitsToBytes(write_bit_ + num_bits);
+  if (required > capacity_) {
+    size_t new_capacity = capacity_ < kMinCapacity ? kMinCapacity : capacity_;
+    while (new_capacity < required) {
+      new_capacity *= 2;
     }
 
-    data_ = new_data;
-    capacity_ = write_offset_ + size;
+    Reserve(new_capacity);
+  }
+}
+
+void Bitstream::Write(const void* data, size_t size) {
+  assert(data);
+
+  EnsureCapacity(size * 8);
+
+  if (write_bit_ % 8 == 0) {
+    std::memcpy(data_ + write_bit_ / 8, data, size);
+    write_bit_ += size * 8;
+    return;
   }
 
-  std::memcpy(data_ + write_offset_, data, size);
-  write_offset_ += size;
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    WriteBits(bytes[i], 8);
+  }
 }
 
 void Bitstream::Read(void* out_data, size_t size) {
   assert(out_data);
-  assert(read_offset_ + size <= write_offset_);
+  assert(read_bit_ + size * 8 <= write_bit_);
 
-  std::memcpy(out_data, data_ + read_offset_, size);
-  read_offset_ += size;
+  if (read_bit_ % 8 == 0) {
+    std::memcpy(out_data, data_ + read_bit_ / 8, size);
+    read_bit_ += size * 8;
+    return;
+  }
+
+  uint8_t* bytes = static_cast<uint8_t*>(out_data);
+  for (size_t i = 0; i < size; ++i) {
+    bytes[i] = static_cast<uint8_t>(ReadBits(8));
+  }
 }
 
 void Bitstream::Skip(size_t size) {
-  assert(read_offset_ + size <= write_offset_);
-  read_offset_ += size;
+  assert(read_bit_ + size * 8 <= write_bit_);
+  read_bit_ += size * 8;
+}
+
+void Bitstream::WriteBits(uint32_t value, uint32_t num_bits) {
+  assert(num_bits <= 32);
+
+  EnsureCapacity(num_bits);
+
+  while (num_bits > 0) {
+    uint32_t bit = write_bit_ % 8;
+    uint32_t chunk = num_bits < 8 - bit ? num_bits : 8 - bit;
+    uint32_t mask = ((1u << chunk) - 1u) << bit;
+
+    uint8_t& byte = data_[write_bit_ / 8];
+    byte = static_cast<uint8_t>((byte & ~mask) | ((value << bit) & mask));
+
+    value >>= chunk;
+    num_bits -= chunk;
+    write_bit_ += chunk;
+  }
+}
+
+uint32_t Bitstream::ReadBits(uint32_t num_bits) {
+  assert(num_bits <= 32);
+  assert(read_bit_ + num_bits <= write_bit_);
+
+  uint32_t value = 0;
+  uint32_t shift = 0;
+  while (num_bits > 0) {
+    uint32_t bit = read_bit_ % 8;
+    uint32_t chunk = num_bits < 8 - bit ? num_bits : 8 - bit;
+    uint32_t mask = (1u << chunk) - 1u;
+
+    value |= ((data_[read_bit_ / 8] >> bit) & mask) << shift;
+
+    shift += chunk;
+    num_bits -= chunk;
+    read_bit_ += chunk;
+  }
+
+  return value;
 }
\ No newline at end of file
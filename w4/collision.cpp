@@ -0,0 +1,51 @@
+#include "collision.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+static constexpr float kMinCellSize = 1.0f;
+
+bool is_colliding(const Entity& first, const Entity& second) {
+  float radius = std::max(first.radius, second.radius);
+  float dx = first.x - second.x;
+  float dy = first.y - second.y;
+
+  return dx * dx + dy * dy <= radius * radius;
+}
+
+void find_collision_pairs_brute_force(const std::vector<Entity>& entities, std::vector<CollisionPair>& out_pairs) {
+  for (uint32_t first = 0; first < entities.size(); ++first) {
+    for (uint32_t second = first + 1; second < entities.size(); ++second) {
+      if (is_colliding(entities[first], entities[second])) {
+        out_pairs.emplace_back(first, second);
+      }
+    }
+  }
+}
+
+void build_collision_grid(const std::vector<Entity>& entities, SpatialHash& grid) {
+  float max_radius = kMinCellSize;
+  for (const Entity& entity : entities) {
+    max_radius = std::max(max_radius, entity.radius);
+  }
+  grid.Build(entities, max_radius);
+}
+
+void find_collision_pairs(const std::vector<Entity>& entities, const SpatialHash& grid,
+                          std::vector<CollisionPair>& out_pairs) {
+  find_collision_pairs(entities, grid, 0, static_cast<uint32_t>(entities.size()), out_pairs);
+}
+
+void find_collision_pairs(const std::vector<Entity>& entities, const SpatialHash& grid, uint32_t begin,
+                          uint32_t end, std::vector<CollisionPair>& out_pairs) {
+  for (uint32_t first = begin; first < end; ++first) {
+    int32_t cell_x = grid.GetCellCoord(entities[first].x);
+    int32_t cell_y = grid.GetCellCoord(entities[first].y);
+
+    grid.ForEachInCells(cell_x - 1, cell_y - 1, cell_x + 1, cell_y + 1, [&](uint32_t second) {
+      if (second > first && is_colliding(entities[first], entities[second])) {
+        out_pairs.emplace_back(first, second);
+      }
+    });
+  }
+}
\ No newline at end of file
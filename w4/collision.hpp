@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "entity.h"
+#include "spatial_hash.hpp"
+
+// Indices into the entities array, first < second
+using CollisionPair = std::pair<uint32_t, uint32_t>;
+
+// The smaller entity collides with the bigger one once its center is inside the bigger one
+bool is_colliding(const Entity& first, const Entity& second);
+
+void find_collision_pairs_brute_force(const std::vector<Entity>& entities, std::vector<CollisionPair>& out_pairs);
+
+// Uniform grid broadphase. Cells are as big as the largest radius, so colliding entities always
+// lie in neighbouring cells.
+void build_collision_grid(const std::vector<Entity>& entities, SpatialHash& grid);
+void find_collision_pairs(const std::vector<Entity>& entities, const SpatialHash& grid,
+                          std::vector<CollisionPair>& out_pairs);
+// Pairs whose first entity is in [begin, end), disjoint ranges can be searched concurrently
+void find_collision_pairs(const std::vector<Entity>& entities, const SpatialHash& grid, uint32_t begin,
+                          uint32_t end, std::vector<CollisionPair>& out_pairs);
\ No newline at end of file
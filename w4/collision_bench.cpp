@@ -0,0 +1,72 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "collision.hpp"
+
+// Entities are spread over an area growing with their count, so density stays the same
+static std::vector<Entity> generate_entities(size_t count, std::mt19937& rng) {
+  const float kAreaPerEntity = 60.0f * 60.0f;
+  float half_size = 0.5f * std::sqrt(count * kAreaPerEntity);
+
+  std::uniform_real_distribution<float> coord(-half_size, half_size);
+  std::uniform_int_distribution<int> radius(1, 3);
+
+  std::vector<Entity> entities;
+  entities.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    Entity& entity = entities.emplace_back(0xff00ffff, coord(rng), coord(rng), static_cast<uint16_t>(i));
+    entity.radius = radius(rng) * 5.0f;
+  }
+
+  return entities;
+}
+
+template<typename Func>
+static double measure_ms(int iterations, Func&& func) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    func();
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  return std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+}
+
+int main(int argc, const char** argv) {
+  std::mt19937 rng(42);
+
+  printf("%10s %16s %16s %10s %8s\n", "entities", "brute force ms", "spatial hash ms", "speedup", "pairs");
+
+  for (size_t count : {1000, 10000, 100000}) {
+    std::vector<Entity> entities = generate_entities(count, rng);
+    std::vector<CollisionPair> pairs;
+
+    // The quadratic path takes seconds at 100k, one run is enough there
+    int brute_force_iterations = count >= 100000 ? 1 : 10;
+    double brute_force_ms = measure_ms(brute_force_iterations, [&]() {
+      pairs.clear();
+      find_collision_pairs_brute_force(entities, pairs);
+    });
+    size_t brute_force_pairs = pairs.size();
+
+    SpatialHash grid;
+    double spatial_hash_ms = measure_ms(10, [&]() {
+      pairs.clear();
+      build_collision_grid(entities, grid);
+      find_collision_pairs(entities, grid, pairs);
+    });
+
+    if (pairs.size() != brute_force_pairs) {
+      printf("Pair count mismatch at %zu entities: %zu vs %zu\n", count, brute_force_pairs, pairs.size());
+      return 1;
+    }
+
+    printf("%10zu %16.3f %16.3f %9.1fx %8zu\n", count, brute_force_ms, spatial_hash_ms,
+           brute_force_ms / spatial_hash_ms, pairs.size());
+  }
+
+  return 0;
+}
\ No newline at end of file
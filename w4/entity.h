@@ -18,3 +18,11 @@ struct Entity
   float target_y = 0.f;
 };
 
+struct EntitySnapshot
+{
+  uint16_t eid = invalid_entity;
+  float x = 0.f;
+  float y = 0.f;
+  float radius = 0.f;
+};
+
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "entity.h"
+
+// Refers to an entity of EntityRegistry, goes stale once that entity is removed even if its eid
+// is reused later
+struct EntityHandle {
+  uint16_t eid{invalid_entity};
+  uint16_t generation{0};
+};
+
+// Dense storage of per-entity values with O(1) lookup by eid. Values are contiguous and iterate
+// in insertion order, removal moves the last value into the freed slot.
+template <typename T>
+class EntityRegistry {
+public:
+  static constexpr uint32_t kInvalidSlot = UINT32_MAX;
+
+  // Inserts the value of eid, overwrites it if eid is already registered
+  T& Add(uint16_t eid, T value) {
+    if (eid >= slots_.size()) {
+      slots_.resize(eid + 1, kInvalidSlot);
+      generations_.resize(eid + 1, 0);
+    }
+
+    uint32_t& slot = slots_[eid];
+    if (slot != kInvalidSlot) {
+      return values_[slot] = std::move(value);
+    }
+
+    slot = static_cast<uint32_t>(values_.size());
+    eids_.push_back(eid);
+    return values_.emplace_back(std::move(value));
+  }
+
+  bool Remove(uint16_t eid) {
+    if (!Contains(eid)) {
+      return false;
+    }
+
+    uint32_t slot = slots_[eid];
+    uint32_t last = static_cast<uint32_t>(values_.size()) - 1;
+    if (slot != last) {
+      values_[slot] = std::move(values_[last]);
+      eids_[slot] = eids_[last];
+      slots_[eids_[slot]] = slot;
+    }
+
+    values_.pop_back();
+    eids_.pop_back();
+    slots_[eid] = kInvalidSlot;
+    ++generations_[eid];
+    return true;
+  }
+
+  void Clear() {
+    for (uint16_t eid : eids_) {
+      slots_[eid] = kInvalidSlot;
+      ++generations_[eid];
+    }
+    values_.clear();
+    eids_.clear();
+  }
+
+  bool Contains(uint16_t eid) const { return eid < slots_.size() && slots_[eid] != kInvalidSlot; }
+  bool IsValid(EntityHandle handle) const {
+    return Contains(handle.eid) && generations_[handle.eid] == handle.generation;
+  }
+
+  T* Find(uint16_t eid) { return Contains(eid) ? &values_[slots_[eid]] : nullptr; }
+  const T* Find(uint16_t eid) const { return Contains(eid) ? &values_[slots_[eid]] : nullptr; }
+  T* Find(EntityHandle handle) { return IsValid(handle) ? &values_[slots_[handle.eid]] : nullptr; }
+  const T* Find(EntityHandle handle) const { return IsValid(handle) ? &values_[slots_[handle.eid]] : nullptr; }
+
+  // Index of the value of eid in Values(), kInvalidSlot if eid isn't registered
+  uint32_t GetSlot(uint16_t eid) const { return Contains(eid) ? slots_[eid] : kInvalidSlot; }
+
+  EntityHandle GetHandle(uint16_t eid) const {
+    return Contains(eid) ? EntityHandle{eid, generations_[eid]} : EntityHandle{};
+  }
+
+  size_t Size() const { return values_.size(); }
+  bool Empty() const { return values_.empty(); }
+
+  // Dense arrays, Eids()[i] is the eid of Values()[i]
+  std::vector<T>& Values() { return values_; }
+  const std::vector<T>& Values() const { return values_; }
+  const std::vector<uint16_t>& Eids() const { return eids_; }
+
+  typename std::vector<T>::iterator begin() { return values_.begin(); }
+  typename std::vector<T>::iterator end() { return values_.end(); }
+  typename std::vector<T>::const_iterator begin() const { return values_.begin(); }
+  typename std::vector<T>::const_iterator end() const { return values_.end(); }
+
+private:
+  std::vector<T> values_;
+  std::vector<uint16_t> eids_;
+
+  // Indexed by eid
+  std::vector<uint32_t> slots_;
+  std::vector<uint16_t> generations_;
+};
+
+// Direct-addressed table of per-entity data for side data that doesn't need dense iteration,
+// eids which were never set read as T{}
+template <typename T>
+class EidMap {
+public:
+  T& operator[](uint16_t eid) {
+    if (eid >= values_.size()) {
+      values_.resize(eid + 1);
+    }
+    return values_[eid];
+  }
+
+  const T& Get(uint16_t eid) const {
+    static const T kDefault{};
+    return eid < values_.size() ? values_[eid] : kDefault;
+  }
+
+  void Clear() { values_.clear(); }
+
+private:
+  std::vector<T> values_;
+};
\ No newline at end of file
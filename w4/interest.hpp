@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "entity.h"
+#include "spatial_hash.hpp"
+
+// Area of interest for snapshot fan-out. Entities within near_radius of the viewer are replicated
+// every tick, entities within far_radius every far_update_period ticks (staggered by eid so the
+// load is spread evenly), the rest of the world isn't replicated to that viewer at all.
+struct InterestSettings {
+  float near_radius;
+  float far_radius;
+  uint32_t far_update_period;
+};
+
+class InterestManager {
+public:
+  explicit InterestManager(const InterestSettings& settings);
+
+  // Starts a new tick and indexes current entity positions
+  void Update(const std::vector<Entity>& entities);
+
+  // Appends sorted indices of entities relevant this tick for a viewer at (x, y)
+  void Gather(const std::vector<Entity>& entities, float x, float y, std::vector<uint32_t>& out_indices) const;
+  // Viewers without an entity of their own get the whole world at the far rate
+  void GatherAll(const std::vector<Entity>& entities, std::vector<uint32_t>& out_indices) const;
+
+private:
+  bool IsFarUpdateDue(uint16_t eid) const;
+
+  InterestSettings settings_;
+  uint32_t tick_{0};
+
+  float cell_size_{1.0f};
+  SpatialHash grid_;
+};
\ No newline at end of file
@@ -5,21 +5,31 @@
 
 #include <vector>
 #include "entity.h"
+#include "entity_registry.hpp"
 #include "protocol.h"
 
 
-static std::vector<Entity> entities;
+static EntityRegistry<Entity> entities;
 static uint16_t my_entity = invalid_entity;
 
+// Entities outside the area of interest stop getting snapshots, they are hidden once their last one
+// is this old instead of being drawn frozen. A few far update periods, so losses don't make them blink
+constexpr uint32_t kStaleEntityTimeoutMs = 500;
+static EidMap<uint32_t> lastSnapshotTimes;
+
+bool is_stale(const Entity &e, uint32_t curTime)
+{
+  return e.eid != my_entity && curTime - lastSnapshotTimes.Get(e.eid) > kStaleEntityTimeoutMs;
+}
+
 void on_new_entity_packet(ENetPacket *packet)
 {
   Entity newEntity;
   deserialize_new_entity(packet, newEntity);
-  // TODO: Direct adressing, of course!
-  for (const Entity &e : entities)
-    if (e.eid == newEntity.eid)
-      return; // don't need to do anything, we already have entity
-  entities.push_back(newEntity);
+  if (entities.Contains(newEntity.eid))
+    return; // don't need to do anything, we already have entity
+  entities.Add(newEntity.eid, newEntity);
+  lastSnapshotTimes[newEntity.eid] = enet_time_get();
 }
 
 void on_set_controlled_entity(ENetPacket *packet)
@@ -27,21 +37,30 @@ void on_set_controlled_entity(ENetPacket *packet)
   deserialize_set_controlled_entity(packet, my_entity);
 }
 
+void apply_snapshot(const EntitySnapshot &snapshot)
+{
+  if (Entity *e = entities.Find(snapshot.eid))
+  {
+    e->x = snapshot.x;
+    e->y = snapshot.y;
+    e->radius = snapshot.radius;
+    lastSnapshotTimes[snapshot.eid] = enet_time_get();
+  }
+}
+
 void on_snapshot(ENetPacket *packet)
 {
-  uint16_t eid = invalid_entity;
-  float x = 0.f;
-  float y = 0.f;
-  float radius = 0.f;
-  deserialize_snapshot(packet, eid, x, y, radius);
-  // TODO: Direct adressing, of course!
-  for (Entity &e : entities)
-    if (e.eid == eid)
-    {
-      e.x = x;
-      e.y = y;
-      e.radius = radius;
-    }
+  EntitySnapshot snapshot{};
+  deserialize_snapshot(packet, snapshot.eid, snapshot.x, snapshot.y, snapshot.radius);
+  apply_snapshot(snapshot);
+}
+
+void on_world_snapshot(ENetPacket *packet)
+{
+  static std::vector<EntitySnapshot> snapshots;
+  deserialize_world_snapshot(packet, snapshots);
+  for (const EntitySnapshot &snapshot : snapshots)
+    apply_snapshot(snapshot);
 }
 
 int main(int argc, const char **argv)
@@ -117,6 +136,9 @@ int main(int argc, const char **argv)
         case E_SERVER_TO_CLIENT_SNAPSHOT:
           on_snapshot(event.packet);
           break;
+        case E_SERVER_TO_CLIENT_WORLD_SNAPSHOT:
+          on_world_snapshot(event.packet);
+          break;
         };
         break;
       default:
@@ -129,27 +151,27 @@ int main(int argc, const char **argv)
       bool right = IsKeyDown(KEY_RIGHT);
       bool up = IsKeyDown(KEY_UP);
       bool down = IsKeyDown(KEY_DOWN);
-      // TODO: Direct adressing, of course!
-      for (Entity &e : entities)
-        if (e.eid == my_entity)
-        {
-          // Update
-          e.x += ((left ? -dt : 0.f) + (right ? +dt : 0.f)) * 100.f;
-          e.y += ((up ? -dt : 0.f) + (down ? +dt : 0.f)) * 100.f;
+      if (Entity *e = entities.Find(my_entity))
+      {
+        // Update
+        e->x += ((left ? -dt : 0.f) + (right ? +dt : 0.f)) * 100.f;
+        e->y += ((up ? -dt : 0.f) + (down ? +dt : 0.f)) * 100.f;
 
-          // Send
-          send_entity_state(serverPeer, my_entity, e.x, e.y);
-        }
+        // Send
+        send_entity_state(serverPeer, my_entity, e->x, e->y);
+      }
     }
 
 
+    uint32_t curTime = enet_time_get();
     BeginDrawing();
       ClearBackground(DARKGRAY);
       BeginBlendMode(BLEND_ADD_COLORS);
       BeginMode2D(camera);
         for (const Entity &e : entities)
         {
-          DrawCircle(e.x, e.y, e.radius, GetColor(e.color));
+          if (!is_stale(e, curTime))
+            DrawCircle(e.x, e.y, e.radius, GetColor(e.color));
         }
 
       EndMode2D();
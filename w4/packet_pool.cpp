@@ -0,0 +1,154 @@
+#include "packet_pool.hpp"
+
+#include <enet/enet.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+
+namespace {
+
+// Covers the packet struct, ENet's commands and everything up to a full world snapshot packet
+constexpr size_t kSizeClasses[] = {64, 128, 256, 512, 1280};
+constexpr uint32_t kSizeClassCount = sizeof(kSizeClasses) / sizeof(kSizeClasses[0]);
+constexpr uint32_t kFallbackClass = kSizeClassCount;
+
+constexpr size_t kSlabSize = 64 * 1024;
+
+// Precedes every block so that free knows where it goes, keeps the payload 16-byte aligned
+struct alignas(16) BlockHeader {
+  uint32_t size_class;
+};
+
+struct FreeBlock {
+  FreeBlock* next;
+};
+
+std::atomic<uint64_t> pooledAllocs{0};
+std::atomic<uint64_t> slabMallocs{0};
+std::atomic<uint64_t> fallbackAllocs{0};
+
+class SpinLock {
+public:
+  void lock() {
+    while (flag_.test_and_set(std::memory_order_acquire)) {
+      while (flag_.test(std::memory_order_relaxed)) {
+      }
+    }
+  }
+
+  void unlock() { flag_.clear(std::memory_order_release); }
+
+private:
+  std::atomic_flag flag_ = ATOMIC_FLAG_INIT;
+};
+
+class SizeClass {
+public:
+  BlockHeader* Pop(uint32_t size_class) {
+    {
+      std::lock_guard<SpinLock> lock(lock_);
+      if (FreeBlock* block = free_) {
+        free_ = block->next;
+        return reinterpret_cast<BlockHeader*>(block);
+      }
+    }
+
+    return Refill(size_class);
+  }
+
+  void Push(BlockHeader* header) {
+    FreeBlock* block = reinterpret_cast<FreeBlock*>(header);
+    std::lock_guard<SpinLock> lock(lock_);
+    block->next = free_;
+    free_ = block;
+  }
+
+private:
+  // Carves a new slab, keeps its first block and puts the rest on the free list
+  BlockHeader* Refill(uint32_t size_class) {
+    const size_t block_size = sizeof(BlockHeader) + kSizeClasses[size_class];
+    const size_t count = kSlabSize / block_size;
+
+    uint8_t* slab = static_cast<uint8_t*>(malloc(count * block_size));
+    if (slab == nullptr) {
+      return nullptr;
+    }
+    slabMallocs.fetch_add(1, std::memory_order_relaxed);
+
+    FreeBlock* first = nullptr;
+    for (size_t i = count - 1; i > 0; --i) {
+      FreeBlock* block = reinterpret_cast<FreeBlock*>(slab + i * block_size);
+      block->next = first;
+      first = block;
+    }
+
+    if (first != nullptr) {
+      FreeBlock* last = reinterpret_cast<FreeBlock*>(slab + (count - 1) * block_size);
+      std::lock_guard<SpinLock> lock(lock_);
+      last->next = free_;
+      free_ = first;
+    }
+
+    return reinterpret_cast<BlockHeader*>(slab);
+  }
+
+  SpinLock lock_;
+  FreeBlock* free_{nullptr};
+};
+
+SizeClass sizeClasses[kSizeClassCount];
+
+uint32_t find_size_class(size_t size) {
+  for (uint32_t i = 0; i < kSizeClassCount; ++i) {
+    if (size <= kSizeClasses[i]) {
+      return i;
+    }
+  }
+  return kFallbackClass;
+}
+
+void* pool_malloc(size_t size) {
+  uint32_t size_class = find_size_class(size);
+
+  BlockHeader* header = nullptr;
+  if (size_class == kFallbackClass) {
+    header = static_cast<BlockHeader*>(malloc(sizeof(BlockHeader) + size));
+    fallbackAllocs.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    header = sizeClasses[size_class].Pop(size_class);
+    pooledAllocs.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  if (header == nullptr) {
+    return nullptr;
+  }
+  header->size_class = size_class;
+  return header + 1;
+}
+
+void pool_free(void* memory) {
+  if (memory == nullptr) {
+    return;
+  }
+
+  BlockHeader* header = static_cast<BlockHeader*>(memory) - 1;
+  if (header->size_class == kFallbackClass) {
+    free(header);
+  } else {
+    sizeClasses[header->size_class].Push(header);
+  }
+}
+
+}  // namespace
+
+int enet_initialize_with_packet_pool() {
+  ENetCallbacks callbacks = {pool_malloc, pool_free, nullptr};
+  return enet_initialize_with_callbacks(ENET_VERSION, &callbacks);
+}
+
+PacketPoolStats get_packet_pool_stats() {
+  return {pooledAllocs.load(std::memory_order_relaxed), slabMallocs.load(std::memory_order_relaxed),
+          fallbackAllocs.load(std::memory_order_relaxed)};
+}
\ No newline at end of file
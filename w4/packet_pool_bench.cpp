@@ -0,0 +1,108 @@
+#include <enet/enet.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "job_system.hpp"
+#include "packet_pool.hpp"
+#include "protocol.h"
+
+// Same shape as the server's tick: every peer gets its world snapshot packets, encoded in parallel,
+// plus a few small reliable messages. ENet frees them all once they are sent.
+constexpr size_t kPeers = 32;
+constexpr size_t kVisibleEntities = 200;
+constexpr size_t kSmallMessagesPerPeer = 4;
+constexpr int kWarmupTicks = 10;
+constexpr int kTicks = 1000;
+
+static std::atomic<uint64_t> systemMallocs{0};
+
+static void* counting_malloc(size_t size) {
+  systemMallocs.fetch_add(1, std::memory_order_relaxed);
+  return malloc(size);
+}
+
+static std::vector<EntitySnapshot> generate_snapshots(std::mt19937& rng) {
+  std::uniform_real_distribution<float> coord(-300.0f, 300.0f);
+
+  std::vector<EntitySnapshot> snapshots;
+  for (size_t i = 0; i < kVisibleEntities; ++i) {
+    snapshots.push_back({static_cast<uint16_t>(i), coord(rng), coord(rng), 10.0f});
+  }
+  return snapshots;
+}
+
+static void run_tick(JobSystem& jobs, const std::vector<EntitySnapshot>& snapshots,
+                     std::vector<std::vector<ENetPacket*>>& peer_packets) {
+  jobs.ParallelFor(kPeers, 1, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      create_world_snapshot_packets(snapshots, peer_packets[i]);
+      for (size_t j = 0; j < kSmallMessagesPerPeer; ++j) {
+        peer_packets[i].push_back(enet_packet_create(nullptr, 16, ENET_PACKET_FLAG_RELIABLE));
+      }
+    }
+  });
+
+  for (std::vector<ENetPacket*>& packets : peer_packets) {
+    for (ENetPacket* packet : packets) {
+      enet_packet_destroy(packet);
+    }
+    packets.clear();
+  }
+}
+
+// Returns microseconds per tick
+static double measure_us(JobSystem& jobs, const std::vector<EntitySnapshot>& snapshots, int ticks) {
+  std::vector<std::vector<ENetPacket*>> peer_packets(kPeers);
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < ticks; ++i) {
+    run_tick(jobs, snapshots, peer_packets);
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  return std::chrono::duration<double, std::micro>(end - start).count() / ticks;
+}
+
+int main(int argc, const char** argv) {
+  std::mt19937 rng(42);
+  std::vector<EntitySnapshot> snapshots = generate_snapshots(rng);
+  JobSystem jobs;
+
+  printf("%10s %16s %12s\n", "allocator", "mallocs / tick", "us / tick");
+
+  ENetCallbacks callbacks = {counting_malloc, free, nullptr};
+  if (enet_initialize_with_callbacks(ENET_VERSION, &callbacks) != 0) {
+    printf("Cannot init ENet\n");
+    return 1;
+  }
+
+  measure_us(jobs, snapshots, kWarmupTicks);
+  uint64_t mallocs_before = systemMallocs.load();
+  double malloc_us = measure_us(jobs, snapshots, kTicks);
+  double malloc_per_tick = double(systemMallocs.load() - mallocs_before) / kTicks;
+  printf("%10s %16.1f %12.1f\n", "malloc", malloc_per_tick, malloc_us);
+  enet_deinitialize();
+
+  // Every packet of the previous run is freed, switching the allocator is safe
+  if (enet_initialize_with_packet_pool() != 0) {
+    printf("Cannot init ENet\n");
+    return 1;
+  }
+
+  measure_us(jobs, snapshots, kWarmupTicks);
+  PacketPoolStats before = get_packet_pool_stats();
+  double pool_us = measure_us(jobs, snapshots, kTicks);
+  PacketPoolStats after = get_packet_pool_stats();
+  double pool_per_tick = double(after.slab_mallocs - before.slab_mallocs +
+                                after.fallback_allocs - before.fallback_allocs) / kTicks;
+  printf("%10s %16.1f %12.1f\n", "pool", pool_per_tick, pool_us);
+  enet_deinitialize();
+
+  printf("%.0f pooled allocations per tick\n", double(after.pooled_allocs - before.pooled_allocs) / kTicks);
+  return 0;
+}
\ No newline at end of file
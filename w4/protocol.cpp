@@ -1,69 +1,136 @@
 #include "protocol.h"
-#include <cstring> // memcpy
+#include <algorithm> // min
 #include "bitstream.hpp"
+#include "serialization.hpp"
+
+// Wire layouts of the messages, each packet is a MessageType followed by its message schema
+struct ControlledEntityMessage
+{
+  uint16_t eid = invalid_entity;
+};
+
+struct EntityStateMessage
+{
+  uint16_t eid = invalid_entity;
+  float x = 0.f;
+  float y = 0.f;
+};
+
+// The map isn't bounded, positions go as they are. AI targets stay on the server.
+using NewEntitySchema = Schema<Field<&Entity::color>,
+                               Field<&Entity::x>,
+                               Field<&Entity::y>,
+                               Field<&Entity::radius>,
+                               Field<&Entity::eid>>;
+using ControlledEntitySchema = Schema<Field<&ControlledEntityMessage::eid>>;
+using EntityStateSchema = Schema<Field<&EntityStateMessage::eid>,
+                                 Field<&EntityStateMessage::x>,
+                                 Field<&EntityStateMessage::y>>;
+using EntitySnapshotSchema = Schema<Field<&EntitySnapshot::eid>,
+                                    Field<&EntitySnapshot::x>,
+                                    Field<&EntitySnapshot::y>,
+                                    Field<&EntitySnapshot::radius>>;
+
+static_assert(NewEntitySchema::kBytes == 18);
+static_assert(ControlledEntitySchema::kBytes == 2);
+static_assert(EntityStateSchema::kBytes == 10);
+static_assert(EntitySnapshotSchema::kBytes == 14);
+
+template<typename MessageSchema, typename T>
+static ENetPacket *create_message_packet(MessageType type, const T &message, uint32_t flags)
+{
+  ENetPacket *packet = enet_packet_create(nullptr, sizeof(MessageType) + MessageSchema::kBytes, flags);
+  Bitstream bitstream = Bitstream::Wrap(packet->data, packet->dataLength);
+  bitstream.Write(type);
+  MessageSchema::Write(bitstream, message);
+  return packet;
+}
+
+template<typename MessageSchema, typename T>
+static void read_message(ENetPacket *packet, T &message)
+{
+  Bitstream bitstream{packet->data, packet->dataLength};
+  bitstream.Skip<MessageType>();
+  MessageSchema::Read(bitstream, message);
+}
 
 void send_join(ENetPeer *peer)
 {
-  Bitstream bitstream;
+  ENetPacket *packet = enet_packet_create(nullptr, sizeof(MessageType), ENET_PACKET_FLAG_RELIABLE);
+  Bitstream bitstream = Bitstream::Wrap(packet->data, packet->dataLength);
   bitstream.Write(E_CLIENT_TO_SERVER_JOIN);
 
-  ENetPacket *packet = enet_packet_create(nullptr, bitstream.Size(), ENET_PACKET_FLAG_RELIABLE);
-  bitstream.Read(packet->data, bitstream.Size());
-
   enet_peer_send(peer, 0, packet);
 }
 
 void send_new_entity(ENetPeer *peer, const Entity &ent)
 {
-  Bitstream bitstream;
-  bitstream.Write(E_SERVER_TO_CLIENT_NEW_ENTITY);
-  bitstream.Write(ent);
-
-  ENetPacket *packet = enet_packet_create(nullptr, bitstream.Size(), ENET_PACKET_FLAG_RELIABLE);
-  bitstream.Read(packet->data, bitstream.Size());
-
+  ENetPacket *packet = create_message_packet<NewEntitySchema>(E_SERVER_TO_CLIENT_NEW_ENTITY, ent,
+                                                              ENET_PACKET_FLAG_RELIABLE);
   enet_peer_send(peer, 0, packet);
 }
 
-void send_set_controlled_entity(ENetPeer *peer, uint16_t eid)
+void broadcast_new_entity(ENetHost *host, const Entity &ent)
 {
-  Bitstream bitstream;
-  bitstream.Write(E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY);
-  bitstream.Write(eid);
-
-  ENetPacket *packet = enet_packet_create(nullptr, bitstream.Size(), ENET_PACKET_FLAG_RELIABLE);
-  bitstream.Read(packet->data, bitstream.Size());
+  ENetPacket *packet = create_message_packet<NewEntitySchema>(E_SERVER_TO_CLIENT_NEW_ENTITY, ent,
+                                                              ENET_PACKET_FLAG_RELIABLE);
+  enet_host_broadcast(host, 0, packet);
+}
 
+void send_set_controlled_entity(ENetPeer *peer, uint16_t eid)
+{
+  ENetPacket *packet = create_message_packet<ControlledEntitySchema>(E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY,
+                                                                     ControlledEntityMessage{eid},
+                                                                     ENET_PACKET_FLAG_RELIABLE);
   enet_peer_send(peer, 0, packet);
 }
 
 void send_entity_state(ENetPeer *peer, uint16_t eid, float x, float y)
 {
-  Bitstream bitstream;
-  bitstream.Write(E_CLIENT_TO_SERVER_STATE);
-  bitstream.Write(eid);
-  bitstream.Write(x);
-  bitstream.Write(y);
-
-  ENetPacket *packet = enet_packet_create(nullptr, bitstream.Size(), ENET_PACKET_FLAG_UNSEQUENCED);
-  bitstream.Read(packet->data, bitstream.Size());
-
+  ENetPacket *packet = create_message_packet<EntityStateSchema>(E_CLIENT_TO_SERVER_STATE,
+                                                                EntityStateMessage{eid, x, y},
+                                                                ENET_PACKET_FLAG_UNSEQUENCED);
   enet_peer_send(peer, 1, packet);
 }
 
 void send_snapshot(ENetPeer *peer, uint16_t eid, float x, float y, float radius)
 {
-  Bitstream bitstream;
-  bitstream.Write(E_SERVER_TO_CLIENT_SNAPSHOT);
-  bitstream.Write(eid);
-  bitstream.Write(x);
-  bitstream.Write(y);
-  bitstream.Write(radius);
+  ENetPacket *packet = create_message_packet<EntitySnapshotSchema>(E_SERVER_TO_CLIENT_SNAPSHOT,
+                                                                   EntitySnapshot{eid, x, y, radius},
+                                                                   ENET_PACKET_FLAG_UNSEQUENCED);
+  enet_peer_send(peer, 1, packet);
+}
 
-  ENetPacket *packet = enet_packet_create(nullptr, bitstream.Size(), ENET_PACKET_FLAG_UNSEQUENCED);
-  bitstream.Read(packet->data, bitstream.Size());
+void create_world_snapshot_packets(const std::vector<EntitySnapshot> &snapshots,
+                                   std::vector<ENetPacket*> &packets)
+{
+  constexpr size_t kHeaderSize = sizeof(MessageType) + sizeof(uint16_t);
+  constexpr size_t kRecordSize = EntitySnapshotSchema::kBytes;
+  constexpr size_t kMaxRecords = (kMaxWorldSnapshotPacketSize - kHeaderSize) / kRecordSize;
+
+  for (size_t first = 0; first < snapshots.size(); first += kMaxRecords)
+  {
+    uint16_t count = std::min(kMaxRecords, snapshots.size() - first);
+
+    ENetPacket *packet = enet_packet_create(nullptr, kHeaderSize + count * kRecordSize,
+                                            ENET_PACKET_FLAG_UNSEQUENCED);
+    Bitstream bitstream = Bitstream::Wrap(packet->data, packet->dataLength);
+    bitstream.Write(E_SERVER_TO_CLIENT_WORLD_SNAPSHOT);
+    bitstream.Write(count);
+    for (size_t i = first; i < first + count; ++i)
+      EntitySnapshotSchema::Write(bitstream, snapshots[i]);
+
+    packets.push_back(packet);
+  }
+}
 
-  enet_peer_send(peer, 1, packet);
+void send_world_snapshot(ENetPeer *peer, const std::vector<EntitySnapshot> &snapshots)
+{
+  static std::vector<ENetPacket*> packets;
+  packets.clear();
+  create_world_snapshot_packets(snapshots, packets);
+  for (ENetPacket *packet : packets)
+    enet_peer_send(peer, 1, packet);
 }
 
 MessageType get_packet_type(ENetPacket *packet)
@@ -73,34 +140,46 @@ MessageType get_packet_type(ENetPacket *packet)
 
 void deserialize_new_entity(ENetPacket *packet, Entity &ent)
 {
-  Bitstream bitstream{packet->data, packet->dataLength};
-  bitstream.Skip<MessageType>();
-  bitstream.Read(ent);
+  ent = Entity{};
+  read_message<NewEntitySchema>(packet, ent);
 }
 
 void deserialize_set_controlled_entity(ENetPacket *packet, uint16_t &eid)
 {
-  Bitstream bitstream{packet->data, packet->dataLength};
-  bitstream.Skip<MessageType>();
-  bitstream.Read(eid);
+  ControlledEntityMessage message;
+  read_message<ControlledEntitySchema>(packet, message);
+  eid = message.eid;
 }
 
 void deserialize_entity_state(ENetPacket *packet, uint16_t &eid, float &x, float &y)
 {
-  Bitstream bitstream{packet->data, packet->dataLength};
-  bitstream.Skip<MessageType>();
-  bitstream.Read(eid);
-  bitstream.Read(x);
-  bitstream.Read(y);
+  EntityStateMessage message;
+  read_message<EntityStateSchema>(packet, message);
+  eid = message.eid;
+  x = message.x;
+  y = message.y;
 }
 
 void deserialize_snapshot(ENetPacket *packet, uint16_t &eid, float &x, float &y, float &radius)
+{
+  EntitySnapshot snapshot;
+  read_message<EntitySnapshotSchema>(packet, snapshot);
+  eid = snapshot.eid;
+  x = snapshot.x;
+  y = snapshot.y;
+  radius = snapshot.radius;
+}
+
+void deserialize_world_snapshot(ENetPacket *packet, std::vector<EntitySnapshot> &snapshots)
 {
   Bitstream bitstream{packet->data, packet->dataLength};
   bitstream.Skip<MessageType>();
-  bitstream.Read(eid);
-  bitstream.Read(x);
-  bitstream.Read(y);
-  bitstream.Read(radius);
+
+  uint16_t count = 0;
+  bitstream.Read(count);
+
+  snapshots.resize(count);
+  for (EntitySnapshot &snapshot : snapshots)
+    EntitySnapshotSchema::Read(bitstream, snapshot);
 }
 
@@ -1,6 +1,7 @@
 #pragma once
 #include <cstdint>
 #include <enet/enet.h>
+#include <vector>
 #include "entity.h"
 
 enum MessageType : uint8_t
@@ -9,14 +10,24 @@ enum MessageType : uint8_t
   E_SERVER_TO_CLIENT_NEW_ENTITY,
   E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY,
   E_CLIENT_TO_SERVER_STATE,
-  E_SERVER_TO_CLIENT_SNAPSHOT
+  E_SERVER_TO_CLIENT_SNAPSHOT,
+  E_SERVER_TO_CLIENT_WORLD_SNAPSHOT
 };
 
+// World snapshots are split so that every packet fits into ENet's default MTU (1400)
+constexpr size_t kMaxWorldSnapshotPacketSize = 1200;
+
 void send_join(ENetPeer *peer);
 void send_new_entity(ENetPeer *peer, const Entity &ent);
+// Encodes the message once and shares the packet between all connected peers
+void broadcast_new_entity(ENetHost *host, const Entity &ent);
 void send_set_controlled_entity(ENetPeer *peer, uint16_t eid);
 void send_entity_state(ENetPeer *peer, uint16_t eid, float x, float y);
 void send_snapshot(ENetPeer *peer, uint16_t eid, float x, float y, float radius);
+void send_world_snapshot(ENetPeer *peer, const std::vector<EntitySnapshot> &snapshots);
+// Encodes the world snapshot without sending it, safe to call from several threads at once
+void create_world_snapshot_packets(const std::vector<EntitySnapshot> &snapshots,
+                                   std::vector<ENetPacket*> &packets);
 
 MessageType get_packet_type(ENetPacket *packet);
 
@@ -24,4 +35,5 @@ void deserialize_new_entity(ENetPacket *packet, Entity &ent);
 void deserialize_set_controlled_entity(ENetPacket *packet, uint16_t &eid);
 void deserialize_entity_state(ENetPacket *packet, uint16_t &eid, float &x, float &y);
 void deserialize_snapshot(ENetPacket *packet, uint16_t &eid, float &x, float &y, float &radius);
+void deserialize_world_snapshot(ENetPacket *packet, std::vector<EntitySnapshot> &snapshots);
 
@@ -1,15 +1,34 @@
 #include <enet/enet.h>
 #include <iostream>
 #include "entity.h"
+#include "entity_registry.hpp"
 #include "protocol.h"
+#include "collision.hpp"
+#include "interest.hpp"
+#include "job_system.hpp"
+#include "packet_pool.hpp"
+#include "time.hpp"
 #include <stdlib.h>
 #include <vector>
-#include <map>
 #include <cmath>
 
 static const size_t kAiEntities = 8;
-static std::vector<Entity> entities;
-static std::map<uint16_t, ENetPeer*> controlledMap;
+static EntityRegistry<Entity> entities;
+// Peer controlling each entity, nullptr for AI entities
+static EidMap<ENetPeer*> controlledMap;
+// Entity controlled by each peer, indexed as host->peers
+static std::vector<EntityHandle> peerEntities;
+
+// Everything close to the player is updated every tick, the rest of the map every 4th tick. The client's
+// camera is fixed and shows +-350 around the origin, the far radius covers all of it from any spawn
+// point (|coord| <= 300), culling only starts once a player walks well off screen
+constexpr InterestSettings kInterestSettings = {250.f, 1000.f, 4};
+
+constexpr float kTickDt = std::chrono::duration<float>(kServerTickPeriod).count();
+
+// Entities per job, enough work to amortise the dispatch while still balancing across workers
+constexpr size_t kEntitiesPerJob = 256;
+static JobSystem jobs;
 
 float random_coord_on_map() {
   return (rand() % 4) * 200.f - 300.0f;
@@ -23,9 +42,11 @@ Entity& spawn_new_entity(uint16_t eid, ENetPeer *peer)
                    0x00000044 * (rand() % 5);
   float x = random_coord_on_map();
   float y = random_coord_on_map();
-  Entity& ent = entities.emplace_back(color, x, y, eid);
+  Entity& ent = entities.Add(eid, Entity(color, x, y, eid));
 
   controlledMap[eid] = peer;
+  if (peer != nullptr)
+    peerEntities[peer - peer->host->peers] = entities.GetHandle(eid);
 
   return ent;
 }
@@ -37,16 +58,15 @@ void on_join(ENetPacket *packet, ENetPeer *peer, ENetHost *host)
     send_new_entity(peer, ent);
 
   // find max eid
-  uint16_t maxEid = entities.empty() ? invalid_entity : entities[0].eid;
-  for (const Entity &e : entities)
-    maxEid = std::max(maxEid, e.eid);
+  uint16_t maxEid = entities.Empty() ? invalid_entity : entities.Eids()[0];
+  for (uint16_t eid : entities.Eids())
+    maxEid = std::max(maxEid, eid);
   uint16_t newEid = maxEid + 1;
   
   Entity& ent = spawn_new_entity(newEid, peer);
 
   // send info about new entity to everyone
-  for (size_t i = 0; i < host->peerCount; ++i)
-    send_new_entity(&host->peers[i], ent);
+  broadcast_new_entity(host, ent);
   // send info about controlled entity
   send_set_controlled_entity(peer, newEid);
 }
@@ -56,12 +76,11 @@ void on_state(ENetPacket *packet)
   uint16_t eid = invalid_entity;
   float x = 0.f; float y = 0.f;
   deserialize_entity_state(packet, eid, x, y);
-  for (Entity &e : entities)
-    if (e.eid == eid)
-    {
-      e.x = x;
-      e.y = y;
-    }
+  if (Entity *e = entities.Find(eid))
+  {
+    e->x = x;
+    e->y = y;
+  }
 }
 
 void spawn_ai_entities()
@@ -73,83 +92,165 @@ void spawn_ai_entities()
   }
 }
 
-void move_ai_entities(float dt)
+// Returns whether the entity reached its target
+bool move_ai_entity(Entity &entity, float dt)
 {
-  for (auto& entity : entities) {
-    if (controlledMap[entity.eid] == nullptr) {
-      float v_x = entity.target_x - entity.x;
-      float v_y = entity.target_y - entity.y;
-
-      float length = std::sqrtf(v_x * v_x + v_y * v_y);
-      if (length != 0.0f) {
-        v_x = 100.0f * v_x / length;
-        v_y = 100.0f * v_y / length;
-      }
+  float v_x = entity.target_x - entity.x;
+  float v_y = entity.target_y - entity.y;
 
-      entity.x += v_x * dt;
-      entity.y += v_y * dt;
+  float length = std::sqrtf(v_x * v_x + v_y * v_y);
+  if (length != 0.0f) {
+    v_x = 100.0f * v_x / length;
+    v_y = 100.0f * v_y / length;
+  }
 
-      float to_target = (entity.target_x - entity.x) * (entity.target_x - entity.x) +
-                        (entity.target_y - entity.y) * (entity.target_y - entity.y);
+  entity.x += v_x * dt;
+  entity.y += v_y * dt;
 
-      if (to_target < 0.001f) {
-        entity.radius = (rand() % 3) * 5.f + 5.0f;
+  float to_target = (entity.target_x - entity.x) * (entity.target_x - entity.x) +
+                    (entity.target_y - entity.y) * (entity.target_y - entity.y);
 
-        entity.target_x = random_coord_on_map();
-        entity.target_y = random_coord_on_map();
-      }
+  return to_target < 0.001f;
+}
+
+void move_ai_entities(float dt)
+{
+  // Indices of entities which reached their targets, one list per job
+  static std::vector<std::vector<uint32_t>> arrived;
+
+  std::vector<Entity> &values = entities.Values();
+  arrived.resize((values.size() + kEntitiesPerJob - 1) / kEntitiesPerJob);
+
+  jobs.ParallelFor(values.size(), kEntitiesPerJob, [&](size_t begin, size_t end) {
+    std::vector<uint32_t> &out = arrived[begin / kEntitiesPerJob];
+    out.clear();
+    for (size_t i = begin; i < end; ++i)
+      if (controlledMap.Get(values[i].eid) == nullptr && move_ai_entity(values[i], dt))
+        out.push_back(i);
+  });
+
+  // rand() isn't thread safe, new targets are picked afterwards
+  for (const std::vector<uint32_t> &indices : arrived) {
+    for (uint32_t i : indices) {
+      Entity &entity = values[i];
+      entity.radius = (rand() % 3) * 5.f + 5.0f;
+
+      entity.target_x = random_coord_on_map();
+      entity.target_y = random_coord_on_map();
     }
   }
 }
 
-void check_collisions() {
-  for (auto& first : entities)
+void resolve_collision(Entity &first, Entity &second)
+{
+  // Either of them might have been respawned by an earlier collision this tick
+  if (!is_colliding(first, second)) { return; }
+
+  auto* small = &first;
+  auto* big = &second;
+  if (big->radius < small->radius)
   {
-    for (auto& second : entities)
-    {
-      if (first.eid == second.eid) { continue; }
+    small = &second;
+    big = &first;
+  }
 
-      auto* small = &first;
-      auto* big = &second;
-      if (big->radius < small->radius)
-      {
-        small = &second;
-        big = &first;
-      }
+  small->radius /= 2.0f;
+  big->radius += small->radius;
 
-      float distance = (big->x - small->x) * (big->x - small->x) +
-                       (big->y - small->y) * (big->y - small->y);
+  small->x = random_coord_on_map();
+  small->y = random_coord_on_map();
 
-      if (distance <= big->radius * big->radius)
-      {
-        small->radius /= 2.0f;
-        big->radius += small->radius;
+  if (ENetPeer *peer = controlledMap.Get(small->eid))
+  {
+    send_snapshot(peer, small->eid, small->x, small->y, small->radius);
+  }
+  else
+  {
+    small->target_x = random_coord_on_map();
+    small->target_y = random_coord_on_map();
+  }
 
-        small->x = random_coord_on_map();
-        small->y = random_coord_on_map();
+  if (ENetPeer *peer = controlledMap.Get(big->eid))
+  {
+    send_snapshot(peer, big->eid, big->x, big->y, big->radius);
+  }
+}
 
-        if (controlledMap[small->eid] != nullptr)
-        {
-          send_snapshot(controlledMap[small->eid], small->eid, small->x, small->y, small->radius);
-        }
-        else
-        {
-          small->target_x = random_coord_on_map();
-          small->target_y = random_coord_on_map();
-        }
+void check_collisions() {
+  static SpatialHash collisionGrid;
+  // Pairs found by each job, concatenated in job order they are the same as found sequentially
+  static std::vector<std::vector<CollisionPair>> pairs;
+
+  std::vector<Entity> &values = entities.Values();
+  build_collision_grid(values, collisionGrid);
+
+  pairs.resize((values.size() + kEntitiesPerJob - 1) / kEntitiesPerJob);
+  jobs.ParallelFor(values.size(), kEntitiesPerJob, [&](size_t begin, size_t end) {
+    std::vector<CollisionPair> &out = pairs[begin / kEntitiesPerJob];
+    out.clear();
+    find_collision_pairs(values, collisionGrid, begin, end, out);
+  });
+
+  // Resolution respawns entities and sends packets, it stays sequential
+  for (const std::vector<CollisionPair> &jobPairs : pairs)
+    for (auto [firstIdx, secondIdx] : jobPairs)
+      resolve_collision(values[firstIdx], values[secondIdx]);
+}
 
-        if (controlledMap[big->eid] != nullptr)
-        {
-          send_snapshot(controlledMap[big->eid], big->eid, big->x, big->y, big->radius);
-        }
+void update_world(ENetHost *server, float dt)
+{
+  move_ai_entities(dt);
+  check_collisions();
+
+  static InterestManager interest(kInterestSettings);
+  interest.Update(entities.Values());
+
+  // Packets are encoded in parallel, ENet itself is only ever called from this thread
+  static std::vector<std::vector<ENetPacket*>> peerPackets;
+  peerPackets.resize(server->peerCount);
+
+  jobs.ParallelFor(server->peerCount, 1, [&](size_t begin, size_t end) {
+    static thread_local std::vector<uint32_t> visible;
+    static thread_local std::vector<EntitySnapshot> snapshots;
+
+    for (size_t i = begin; i < end; ++i)
+    {
+      // Snapshots are personalised, nothing is encoded for empty slots
+      if (server->peers[i].state != ENET_PEER_STATE_CONNECTED)
+        continue;
+
+      const Entity *viewer = entities.Find(peerEntities[i]);
+
+      visible.clear();
+      if (viewer != nullptr)
+        interest.Gather(entities.Values(), viewer->x, viewer->y, visible);
+      else
+        interest.GatherAll(entities.Values(), visible);
+
+      snapshots.clear();
+      for (uint32_t idx : visible)
+      {
+        const Entity &e = entities.Values()[idx];
+        if (&e != viewer)
+          snapshots.push_back({e.eid, e.x, e.y, e.radius});
       }
+
+      create_world_snapshot_packets(snapshots, peerPackets[i]);
     }
+  });
+
+  for (size_t i = 0; i < server->peerCount; ++i)
+  {
+    for (ENetPacket *packet : peerPackets[i])
+      enet_peer_send(&server->peers[i], 1, packet);
+    peerPackets[i].clear();
   }
 }
 
 int main(int argc, const char **argv)
 {
-  if (enet_initialize() != 0)
+  // Snapshots allocate a few packets per peer every tick, they are recycled instead of malloc'ed
+  if (enet_initialize_with_packet_pool() != 0)
   {
     printf("Cannot init ENet");
     return 1;
@@ -167,16 +268,15 @@ int main(int argc, const char **argv)
     return 1;
   }
 
+  peerEntities.resize(server->peerCount);
   spawn_ai_entities();
 
-  clock_t time_start = clock();
+  TickScheduler scheduler(kServerTickPeriod);
   while (true)
   {
-    float dt = (0.0f + clock() - time_start) / CLOCKS_PER_SEC;
-    time_start = clock();
-
+    // wait for network events until the next tick is due
     ENetEvent event;
-    while (enet_host_service(server, &event, 0) > 0)
+    while (enet_host_service(server, &event, scheduler.TimeUntilNextTickMs()) > 0)
     {
       switch (event.type)
       {
@@ -200,18 +300,12 @@ int main(int argc, const char **argv)
       };
     }
 
-    move_ai_entities(dt);
-    check_collisions();
-
-    static int t = 0;
-    for (const Entity &e : entities)
-      for (size_t i = 0; i < server->peerCount; ++i)
-      {
-        ENetPeer *peer = &server->peers[i];
-        if (controlledMap[e.eid] != peer)
-          send_snapshot(peer, e.eid, e.x, e.y, e.radius);
-      }
-    //usleep(400000);
+    for (uint32_t ticks = scheduler.ConsumeDueTicks(); ticks > 0; --ticks)
+    {
+      scheduler.BeginTick();
+      update_world(server, kTickDt);
+      scheduler.EndTick();
+    }
   }
 
   enet_host_destroy(server);
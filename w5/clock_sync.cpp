@@ -0,0 +1,66 @@
+#include "clock_sync.hpp"
+
+#include <cmath>
+
+#include "time.hpp"
+
+// Until the window is filled requests are sent this often, afterwards kSyncedRequestPeriod
+static constexpr std::chrono::milliseconds kInitialRequestPeriod{100};
+static constexpr std::chrono::milliseconds kSyncedRequestPeriod{1000};
+// Corrections larger than this many ticks are applied at once, smaller ones gradually
+static constexpr double kMaxSlewTicks = 2.0;
+static constexpr double kSlewGain = 0.25;
+
+static double to_ticks(double seconds) {
+  return seconds / std::chrono::duration<double>(kServerTickPeriod).count();
+}
+
+double ServerClock::GetLocalTime(Clock::time_point now) {
+  return std::chrono::duration<double>(now.time_since_epoch()).count();
+}
+
+bool ServerClock::ShouldSendRequest(Clock::time_point now) {
+  auto period = requests_sent_ < kWindowSize ? kInitialRequestPeriod : kSyncedRequestPeriod;
+  if (requests_sent_ > 0 && now - last_request_ < period) {
+    return false;
+  }
+
+  ++requests_sent_;
+  last_request_ = now;
+  return true;
+}
+
+void ServerClock::OnResponse(double client_time, double server_tick, Clock::time_point now) {
+  double local_time = GetLocalTime(now);
+  double rtt = local_time - client_time;
+  if (rtt < 0.0) {
+    return;
+  }
+
+  // The response left the server about half a round trip ago
+  samples_[next_sample_] = {server_tick + to_ticks(rtt / 2.0) - to_ticks(local_time), rtt};
+  next_sample_ = (next_sample_ + 1) % kWindowSize;
+  if (sample_count_ < kWindowSize) {
+    ++sample_count_;
+  }
+
+  const Sample* best = &samples_[0];
+  for (size_t i = 1; i < sample_count_; ++i) {
+    if (samples_[i].rtt < best->rtt) {
+      best = &samples_[i];
+    }
+  }
+
+  rtt_ = best->rtt;
+  double correction = best->offset - offset_;
+  if (!synced_ || std::fabs(correction) > kMaxSlewTicks) {
+    offset_ = best->offset;
+    synced_ = true;
+  } else {
+    offset_ += correction * kSlewGain;
+  }
+}
+
+double ServerClock::EstimateTick(Clock::time_point now) const {
+  return to_ticks(GetLocalTime(now)) + offset_;
+}
\ No newline at end of file
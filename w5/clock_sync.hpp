@@ -0,0 +1,48 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Estimates the tick the server is simulating right now from time requests it answers, NTP style.
+// Of the recent samples the one with the lowest round trip is trusted, queuing delays skew it the
+// least. Small corrections are slewed in so the estimate doesn't jump.
+class ServerClock {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  // Whether a time request should be sent now, they go out often until the clock is synced
+  bool ShouldSendRequest(Clock::time_point now);
+
+  // Local timestamp to put into a time request, in seconds
+  static double GetLocalTime(Clock::time_point now);
+
+  void OnResponse(double client_time, double server_tick, Clock::time_point now);
+
+  bool IsSynced() const { return synced_; }
+
+  // Fractional server tick at now, only meaningful once synced
+  double EstimateTick(Clock::time_point now) const;
+
+  // Round trip of the sample in use, in seconds
+  double GetRtt() const { return rtt_; }
+
+private:
+  struct Sample {
+    double offset;  // Server tick minus local time in ticks
+    double rtt;     // In seconds
+  };
+
+  static constexpr size_t kWindowSize = 8;
+  std::array<Sample, kWindowSize> samples_{};
+  size_t sample_count_{0};
+  size_t next_sample_{0};
+
+  bool synced_{false};
+  double offset_{0.0};
+  double rtt_{0.0};
+
+  uint32_t requests_sent_{0};
+  Clock::time_point last_request_{};
+};
\ No newline at end of file
@@ -2,6 +2,8 @@
 #include <cstdint>
 
 constexpr uint16_t invalid_entity = -1;
+constexpr uint32_t invalid_gen = -1;
+constexpr uint32_t invalid_input = -1;
 struct Entity
 {
   uint32_t color = 0xff00ffff;
@@ -0,0 +1,85 @@
+#include "input_buffer.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+// Depth in multiples of the measured jitter
+static constexpr float kJitterDepthFactor = 3.0f;
+// Share of the excess above the target depth drained every tick
+static constexpr float kDrainRate = 0.1f;
+
+void InputJitterBuffer::Receive(const std::vector<InputSnapshot>& inputs, double arrival_time) {
+  bool received_new = false;
+  for (const InputSnapshot& input : inputs) {
+    if (last_received_ != invalid_input && input.input_num <= last_received_) {
+      continue;
+    }
+
+    if (inputs_.Full()) {
+      buffered_time_ -= inputs_.Front().dt;
+    }
+    InputSnapshot clamped = input;
+    clamped.dt = std::clamp(input.dt, 0.f, kMaxInputDt);
+    inputs_.Push(clamped);
+    buffered_time_ += clamped.dt;
+    client_time_ += clamped.dt;
+    last_received_ = input.input_num;
+    received_new = true;
+  }
+
+  if (!received_new) {
+    return;
+  }
+
+  double transit = arrival_time - client_time_;
+  if (has_transit_) {
+    float deviation = static_cast<float>(std::fabs(transit - last_transit_));
+    jitter_ += (deviation - jitter_) / 16.0f;
+  }
+  last_transit_ = transit;
+  has_transit_ = true;
+}
+
+float InputJitterBuffer::GetTargetDepth() const {
+  return std::clamp(kJitterDepthFactor * jitter_, kMinDepth, kMaxDepth);
+}
+
+void InputJitterBuffer::Consume(float tick_dt, std::vector<InputSnapshot>& out_inputs) {
+  float target_depth = GetTargetDepth();
+  if (!playing_) {
+    if (buffered_time_ < target_depth) {
+      return;
+    }
+    playing_ = true;
+  }
+
+  budget_ += tick_dt;
+  // More buffered than needed (a burst or a client clock running fast), catch up gradually
+  if (buffered_time_ > target_depth + tick_dt) {
+    budget_ += kDrainRate * (buffered_time_ - target_depth);
+  }
+  float max_budget = kMaxTicksPerTick * tick_dt;
+  budget_ = std::min(budget_, max_budget);
+
+  while (!inputs_.Empty()) {
+    InputSnapshot input = inputs_.Front();
+    // A frame longer than the whole per tick limit would never fit, it is shortened instead
+    float dt = std::min(input.dt, max_budget);
+    if (dt > budget_) {
+      break;
+    }
+
+    budget_ -= dt;
+    buffered_time_ -= input.dt;
+    input.dt = dt;
+    out_inputs.push_back(input);
+    inputs_.PopFront();
+  }
+
+  // Ran dry, refill to the target depth before playing again
+  if (inputs_.Empty()) {
+    playing_ = false;
+    budget_ = 0.f;
+    buffered_time_ = 0.f;
+  }
+}
\ No newline at end of file
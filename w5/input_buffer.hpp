@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "entity.h"
+#include "ring_buffer.hpp"
+
+// Per-client input jitter buffer. Instead of applying inputs in bursts as they arrive, the server
+// consumes one tick worth of client time per tick. Playback starts once the buffer holds a depth
+// adapted to the measured arrival jitter, so uneven arrivals don't starve it.
+class InputJitterBuffer {
+public:
+  // Longest client frame simulated as is, longer ones are clamped
+  static constexpr float kMaxInputDt = 0.1f;
+  // Client time simulated per tick never exceeds this many ticks
+  static constexpr float kMaxTicksPerTick = 2.0f;
+  // Limits of the adaptive depth, in seconds
+  static constexpr float kMinDepth = 0.02f;
+  static constexpr float kMaxDepth = 0.25f;
+
+  // Adds inputs received in one packet at arrival_time (seconds), inputs received before are skipped
+  void Receive(const std::vector<InputSnapshot>& inputs, double arrival_time);
+
+  // Appends inputs to simulate during a tick of tick_dt seconds to out_inputs, dt of each clamped
+  void Consume(float tick_dt, std::vector<InputSnapshot>& out_inputs);
+
+  float GetTargetDepth() const;
+  float GetBufferedTime() const { return buffered_time_; }
+
+private:
+  RingBuffer<InputSnapshot, 128, &InputSnapshot::input_num> inputs_;
+  uint32_t last_received_{invalid_input};
+  float buffered_time_{0.f};
+
+  // Client time not simulated yet, carried over between ticks
+  float budget_{0.f};
+  // Whether the buffer has filled up to the target depth since it last ran empty
+  bool playing_{false};
+
+  // Arrival jitter estimate (RFC 3550): smoothed variation of arrival time relative to client time
+  double client_time_{0.0};
+  double last_transit_{0.0};
+  bool has_transit_{false};
+  float jitter_{0.f};
+};
\ No newline at end of file
@@ -0,0 +1,54 @@
+#include "interpolation.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+
+// Smoothing of the latency and jitter estimates, as in RFC 3550
+static constexpr double kEstimateGain = 1.0 / 16.0;
+// Share of the difference to the target delay applied per snapshot, keeps the render time smooth
+static constexpr float kDelayGain = 0.05f;
+
+SnapshotInterpolator::SnapshotInterpolator(const InterpolationSettings& settings)
+    : settings_(settings), delay_(settings.min_delay) {}
+
+void SnapshotInterpolator::OnSnapshot(uint32_t gen, double server_tick) {
+  // Every chunk of a gen arrives at about the same time, only the first one is a new sample
+  if (last_gen_ != invalid_gen && gen <= last_gen_) {
+    return;
+  }
+  last_gen_ = gen;
+
+  double sample = server_tick - gen;
+  if (!started_) {
+    latency_ = sample;
+    started_ = true;
+    render_tick_ = gen - delay_;
+    return;
+  }
+
+  double deviation = sample - latency_;
+  latency_ += deviation * kEstimateGain;
+  jitter_ += static_cast<float>((std::fabs(deviation) - jitter_) * kEstimateGain);
+
+  float target = std::clamp(settings_.min_delay + settings_.jitter_factor * jitter_, settings_.min_delay,
+                            settings_.max_delay);
+  delay_ += (target - delay_) * kDelayGain;
+}
+
+double SnapshotInterpolator::Advance(double server_tick) {
+  if (started_) {
+    render_tick_ = std::max(render_tick_, server_tick - latency_ - delay_);
+  }
+  return render_tick_;
+}
+
+float lerp_float(float from, float to, float t) {
+  return from + t * (to - from);
+}
+
+float lerp_angle(float from, float to, float t) {
+  constexpr float kPi = std::numbers::pi_v<float>;
+  float delta = std::remainder(to - from, 2.f * kPi);
+  return from + t * delta;
+}
\ No newline at end of file
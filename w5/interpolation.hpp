@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+
+#include "entity.h"
+#include "ring_buffer.hpp"
+
+struct InterpolationSettings {
+  // Render delay in server ticks, the delay grows with jitter from min_delay up to max_delay
+  float min_delay;
+  float max_delay;
+  // Ticks of delay added per tick of measured snapshot jitter
+  float jitter_factor;
+};
+
+// Picks the server tick remote entities are rendered at. Snapshots arrive some latency after the
+// server tick they were taken at, rendering happens that latency plus a jitter dependent delay
+// behind the current server tick so a newer snapshot has almost always arrived already.
+class SnapshotInterpolator {
+public:
+  explicit SnapshotInterpolator(const InterpolationSettings& settings);
+
+  // server_tick is the estimate of the current server tick at the arrival
+  void OnSnapshot(uint32_t gen, double server_tick);
+
+  // Server tick to render at when the server is at server_tick, fractional and never going back
+  double Advance(double server_tick);
+
+  float GetDelay() const { return delay_; }
+  float GetLatency() const { return static_cast<float>(latency_); }
+  float GetJitter() const { return jitter_; }
+
+private:
+  InterpolationSettings settings_;
+
+  bool started_{false};
+  uint32_t last_gen_{invalid_gen};
+  // Ticks between a snapshot being taken and received, smoothed over arrivals
+  double latency_{0.0};
+  float jitter_{0.f};
+  float delay_{0.f};
+  double render_tick_{0.0};
+};
+
+float lerp_float(float from, float to, float t);
+
+// Takes the shortest way around the circle, from and to are in radians
+float lerp_angle(float from, float to, float t);
+
+// Interpolates the state at a fractional gen between the two snapshots around it. Before the oldest
+// and after the newest snapshot their state is held, nothing is extrapolated.
+template <size_t Capacity>
+bool sample_snapshots(const RingBuffer<EntitySnapshot, Capacity>& snapshots, double gen, EntitySnapshot& out) {
+  if (snapshots.Empty()) {
+    return false;
+  }
+
+  // First snapshot strictly after gen
+  size_t next = snapshots.LowerBound(static_cast<uint32_t>(gen) + 1);
+  if (next == 0) {
+    out = snapshots.Front();
+    return true;
+  }
+  if (next == snapshots.Size()) {
+    out = snapshots.Back();
+    return true;
+  }
+
+  const EntitySnapshot& first = snapshots[next - 1];
+  const EntitySnapshot& second = snapshots[next];
+  float t = static_cast<float>((gen - first.gen) / (second.gen - first.gen));
+
+  out = second;
+  out.x = lerp_float(first.x, second.x, t);
+  out.y = lerp_float(first.y, second.y, t);
+  out.ori = lerp_angle(first.ori, second.ori, t);
+  return true;
+}
\ No newline at end of file
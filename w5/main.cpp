@@ -5,37 +5,76 @@
 #include <enet/enet.h>
 #include <math.h>
 
-#include <deque>
 #include <vector>
-#include <unordered_map>
+#include <algorithm>
 #include "entity.h"
+#include "entity_registry.hpp"
+#include "ring_buffer.hpp"
+#include "interpolation.hpp"
+#include "clock_sync.hpp"
 #include "protocol.h"
 #include "time.hpp"
 #include <cmath>
 
-static std::unordered_map<uint16_t, std::deque<EntitySnapshot>> entitySnapshots;
-static std::unordered_map<uint16_t, uint32_t> lastUpdateTime;
+static EidMap<RingBuffer<EntitySnapshot, kSnapshotHistorySize>> entitySnapshots;
 
-static std::vector<InputSnapshot> playerInputSnapshots;
+// Remote entities are rendered at least 2 ticks in the past, more when snapshots arrive unevenly
+constexpr InterpolationSettings kInterpolationSettings = {2.f, 10.f, 3.f};
+static SnapshotInterpolator interpolator(kInterpolationSettings);
+static ServerClock serverClock;
+
+// Input of the controlled entity along with the state predicted after applying it
+struct PredictedInput
+{
+  uint32_t input_num = 0;
+  uint32_t gen = 0;
+  float thr = 0.f;
+  float steer = 0.f;
+  float dt = 0.f;
+
+  float x = 0.f;
+  float y = 0.f;
+  float ori = 0.f;
+  float speed = 0.f;
+};
+
+// Inputs not yet confirmed by the server, 4 seconds at 60 fps
+constexpr size_t kInputHistorySize = 256;
+static RingBuffer<PredictedInput, kInputHistorySize, &PredictedInput::input_num> playerInputSnapshots;
+static uint32_t lastAckedInput = invalid_input;
+
+// Prediction is only corrected when it is off by more than this
+constexpr float kRollbackTolerance = 0.01f;
+
+// Reconciliation statistics of the current second
+struct RollbackStats
+{
+  uint32_t rollbacks = 0;
+  uint32_t replayedInputs = 0;
+  double replayMs = 0.0;
+  uint32_t startTime = 0;
+};
+static RollbackStats rollbackStats;
 
 static uint32_t inputGen = 0;
 
-static std::vector<Entity> entities;
+static EntityRegistry<Entity> entities;
 static uint16_t my_entity = invalid_entity;
 
-bool FloatsEqual(float a, float b) {
-  return std::fabs(a - b) < 0.001f;
+bool IsPredictionValid(const PredictedInput &predicted, const EntitySnapshot &snapshot, float speed) {
+  return std::fabs(predicted.x - snapshot.x) <= kRollbackTolerance &&
+         std::fabs(predicted.y - snapshot.y) <= kRollbackTolerance &&
+         std::fabs(predicted.ori - snapshot.ori) <= kRollbackTolerance &&
+         std::fabs(predicted.speed - speed) <= kRollbackTolerance;
 }
 
 void on_new_entity_packet(ENetPacket *packet)
 {
   Entity newEntity;
   deserialize_new_entity(packet, newEntity);
-  // TODO: Direct adressing, of course!
-  for (const Entity &e : entities)
-    if (e.eid == newEntity.eid)
-      return; // don't need to do anything, we already have entity
-  entities.push_back(newEntity);
+  if (entities.Contains(newEntity.eid))
+    return; // don't need to do anything, we already have entity
+  entities.Add(newEntity.eid, newEntity);
 }
 
 void on_set_controlled_entity(ENetPacket *packet)
@@ -43,80 +82,181 @@ void on_set_controlled_entity(ENetPacket *packet)
   deserialize_set_controlled_entity(packet, my_entity);
 }
 
-void local_simulation_rollback(const EntitySnapshot& snapshot)
+// Restarts prediction from the server state and replays inputs the server hasn't applied yet
+void local_simulation_rollback(Entity &e, const EntitySnapshot& snapshot, float speed)
 {
-  Entity& e = entities[my_entity];
+  auto start = std::chrono::steady_clock::now();
+
   e.x = snapshot.x;
   e.y = snapshot.y;
   e.ori = snapshot.ori;
+  e.speed = speed;
   e.gen = snapshot.gen;
 
-  size_t inputs_size = playerInputSnapshots.size();
-  if (inputs_size > 0) {
-    size_t idx = inputs_size - 1;
-    for (; idx > 0 && playerInputSnapshots[idx].gen >= snapshot.gen; --idx) { ; }
+  for (size_t idx = 0; idx < playerInputSnapshots.Size(); ++idx) {
+    PredictedInput &input = playerInputSnapshots[idx];
+    e.thr = input.thr;
+    e.steer = input.steer;
 
-    for (; idx < inputs_size; ++idx) {
-      e.thr = playerInputSnapshots[idx].thr;
-      e.steer = playerInputSnapshots[idx].steer;
+    simulate_entity(e, input.dt);
 
-      simulate_entity(e, playerInputSnapshots[idx].dt);
-    }
+    input.x = e.x;
+    input.y = e.y;
+    input.ori = e.ori;
+    input.speed = e.speed;
   }
+
+  ++rollbackStats.rollbacks;
+  rollbackStats.replayedInputs += playerInputSnapshots.Size();
+  rollbackStats.replayMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
 }
 
-void on_snapshot(ENetPacket *packet)
+void reconcile_prediction(Entity &e, const EntitySnapshot &snapshot, const InputAck &inputAck)
 {
-  EntitySnapshot snapshot{};
-  deserialize_snapshot(packet, snapshot);
+  if (inputAck.inputNum == invalid_input)
+  {
+    // The server hasn't applied any input yet, nothing was confirmed
+    if (lastAckedInput == invalid_input)
+      local_simulation_rollback(e, snapshot, inputAck.speed);
+    return;
+  }
+
+  // Snapshots are unsequenced, older ones may arrive late. Without new inputs applied the server
+  // state is the one already checked.
+  if (lastAckedInput != invalid_input && inputAck.inputNum <= lastAckedInput)
+    return;
+  lastAckedInput = inputAck.inputNum;
+
+  const PredictedInput *predicted = playerInputSnapshots.Find(inputAck.inputNum);
+  bool valid = predicted != nullptr && IsPredictionValid(*predicted, snapshot, inputAck.speed);
+
+  // Inputs up to the acknowledged one are applied in the snapshot
+  playerInputSnapshots.DropBefore(inputAck.inputNum + 1);
 
+  if (!valid)
+    local_simulation_rollback(e, snapshot, inputAck.speed);
+}
+
+void report_rollback_stats(uint32_t curTime)
+{
+  if (curTime - rollbackStats.startTime < 1000)
+    return;
+
+  if (rollbackStats.rollbacks > 0)
+    printf("Rollbacks: %u/s, replayed inputs: %u/s, replay time: %.3f ms/s\n", rollbackStats.rollbacks,
+           rollbackStats.replayedInputs, rollbackStats.replayMs);
+
+  rollbackStats = RollbackStats{};
+  rollbackStats.startTime = curTime;
+}
+
+void apply_snapshot(const EntitySnapshot &snapshot, const InputAck &inputAck)
+{
   auto& snapshots = entitySnapshots[snapshot.eid];
 
-  if (snapshots.empty() || snapshots.back().gen < snapshot.gen) {
-    snapshots.push_back(snapshot);
+  if (snapshots.Empty() || snapshots.Back().gen < snapshot.gen) {
+    snapshots.Push(snapshot);
   }
 
-  lastUpdateTime[snapshot.eid] = enet_time_get();
+  // Other entities are moved by interpolate_entities
+  Entity *e = entities.Find(snapshot.eid);
+  if (e != nullptr && e->eid == my_entity)
+    reconcile_prediction(*e, snapshot, inputAck);
+}
 
-  // TODO: Direct adressing, of course!
-  for (Entity &e : entities)
-    if (e.eid == snapshot.eid)
+const EntitySnapshot* find_snapshot(uint16_t eid, uint32_t gen)
+{
+  return entitySnapshots.Get(eid).Find(gen);
+}
+
+void on_world_snapshot(ENetPacket *packet, ENetPeer *serverPeer)
+{
+  static WorldSnapshotHeader header;
+  static std::vector<EntitySnapshotDelta> deltas;
+  static std::vector<EntitySnapshot> snapshots;
+  deserialize_world_snapshot(packet, header, deltas);
+  if (serverClock.IsSynced())
+    interpolator.OnSnapshot(header.gen, serverClock.EstimateTick(ServerClock::Clock::now()));
+
+  snapshots.clear();
+  for (const EntitySnapshotDelta &delta : deltas)
+  {
+    EntitySnapshot snapshot = delta.snapshot;
+    if (delta.fields != E_SNAPSHOT_FIELD_ALL)
     {
-      if (e.eid == my_entity) {
-        if (!FloatsEqual(e.x, snapshot.x) || !FloatsEqual(e.y, snapshot.y) || !FloatsEqual(e.ori, snapshot.ori)) {
-          local_simulation_rollback(snapshot);
-        }
+      const EntitySnapshot *baseline = find_snapshot(snapshot.eid, header.baselineGen);
+      if (baseline == nullptr)
         continue;
-      }
 
-      e.x = snapshot.x;
-      e.y = snapshot.y;
-      e.ori = snapshot.ori;
-      e.gen = snapshot.gen;
+      if (!(delta.fields & E_SNAPSHOT_FIELD_X))
+        snapshot.x = baseline->x;
+      if (!(delta.fields & E_SNAPSHOT_FIELD_Y))
+        snapshot.y = baseline->y;
+      if (!(delta.fields & E_SNAPSHOT_FIELD_ORI))
+        snapshot.ori = baseline->ori;
+    }
+    snapshots.push_back(snapshot);
+  }
+
+  // Entities of the chunk's range without a delta didn't change since the baseline
+  if (header.baselineGen != invalid_gen)
+  {
+    for (uint16_t eid : entities.Eids())
+    {
+      if (eid < header.firstEid || eid > header.lastEid)
+        continue;
+
+      auto delta = std::lower_bound(deltas.begin(), deltas.end(), eid,
+        [](const EntitySnapshotDelta& delta, uint16_t eid) { return delta.snapshot.eid < eid; });
+      if (delta != deltas.end() && delta->snapshot.eid == eid)
+        continue;
+
+      if (const EntitySnapshot *baseline = find_snapshot(eid, header.baselineGen))
+      {
+        EntitySnapshot snapshot = *baseline;
+        snapshot.gen = header.gen;
+        snapshots.push_back(snapshot);
+      }
     }
+  }
+
+  for (const EntitySnapshot &snapshot : snapshots)
+    apply_snapshot(snapshot, header.inputAck);
+
+  // The gen becomes a valid baseline only once every chunk of it arrived
+  static uint32_t chunksGen = invalid_gen;
+  static uint16_t chunksReceived = 0;
+  if (header.gen != chunksGen)
+  {
+    chunksGen = header.gen;
+    chunksReceived = 0;
+  }
+
+  if (++chunksReceived == header.chunkCount)
+    send_snapshot_ack(serverPeer, header.gen);
 }
 
-float lerp(float a, float b, float t) {
-  return a + t * (b - a);
+void on_time_response(ENetPacket *packet)
+{
+  double clientTime = 0.0;
+  double serverTick = 0.0;
+  deserialize_time_response(packet, clientTime, serverTick);
+  serverClock.OnResponse(clientTime, serverTick, ServerClock::Clock::now());
 }
 
-void interpolate_entities(uint32_t cur_time)
+void interpolate_entities(double renderGen)
 {
-  for (auto& [eid, snapshots] : entitySnapshots)
+  for (Entity &entity : entities)
   {
-    if (eid == my_entity) { continue; }
+    if (entity.eid == my_entity) { continue; }
 
-    auto& entity = entities[eid];
-
-    if (snapshots.size() > 2)
+    EntitySnapshot state;
+    if (sample_snapshots(entitySnapshots.Get(entity.eid), renderGen, state))
     {
-      const auto& first = *(snapshots.end() - 2);
-      const auto& second = *(snapshots.end() - 1);
-
-      float t = (cur_time - lastUpdateTime[eid]) * (second.gen - first.gen) / kServerFixedTimeStepF;
-      entity.x = lerp(first.x, second.x, t);
-      entity.y = lerp(first.y, second.y, t);
-      entity.ori = lerp(first.ori, second.ori, t);
+      entity.x = state.x;
+      entity.y = state.y;
+      entity.ori = state.ori;
+      entity.gen = state.gen;
     }
   }
 }
@@ -170,11 +310,11 @@ int main(int argc, const char **argv)
   SetTargetFPS(60);               // Set our game to run at 60 frames-per-second
 
   bool connected = false;
-  uint32_t lastSimulationTime = enet_time_get();
   while (!WindowShouldClose())
   {
     float dt = GetFrameTime();
     uint32_t curTime = enet_time_get();
+    ServerClock::Clock::time_point now = ServerClock::Clock::now();
     ENetEvent event;
     while (enet_host_service(client, &event, 0) > 0)
     {
@@ -194,8 +334,11 @@ int main(int argc, const char **argv)
         case E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY:
           on_set_controlled_entity(event.packet);
           break;
-        case E_SERVER_TO_CLIENT_SNAPSHOT:
-          on_snapshot(event.packet);
+        case E_SERVER_TO_CLIENT_WORLD_SNAPSHOT:
+          on_world_snapshot(event.packet, serverPeer);
+          break;
+        case E_SERVER_TO_CLIENT_TIME_RESPONSE:
+          on_time_response(event.packet);
           break;
         };
         break;
@@ -203,47 +346,54 @@ int main(int argc, const char **argv)
         break;
       };
     }
+    if (connected && serverClock.ShouldSendRequest(now))
+      send_time_request(serverPeer, ServerClock::GetLocalTime(now));
+
     if (my_entity != invalid_entity)
     {
-      uint32_t gens_passed = (curTime - lastSimulationTime) / kServerFixedTimeStep;
-      if (gens_passed > 0) {
-        lastSimulationTime = curTime;
-      }
-
       bool left = IsKeyDown(KEY_LEFT);
       bool right = IsKeyDown(KEY_RIGHT);
       bool up = IsKeyDown(KEY_UP);
       bool down = IsKeyDown(KEY_DOWN);
-      // TODO: Direct adressing, of course!
-      for (Entity &e : entities)
+      if (Entity *e = entities.Find(my_entity))
       {
-        if (e.eid == my_entity)
+        // Update
+        float thr = (up ? 1.f : 0.f) + (down ? -1.f : 0.f);
+        float steer = (left ? -1.f : 0.f) + (right ? 1.f : 0.f);
+
+        // Inputs are stamped with the tick the server is at now
+        uint32_t gen = serverClock.IsSynced() ? static_cast<uint32_t>(serverClock.EstimateTick(now)) : e->gen;
+        e->thr = thr;
+        e->steer = steer;
+        e->gen = gen;
+        simulate_entity(*e, dt);
+
+        playerInputSnapshots.Push({inputGen++, gen, thr, steer, dt, e->x, e->y, e->ori, e->speed});
+
+        // Send, along with the previous inputs the server hasn't acknowledged yet
+        static std::vector<InputSnapshot> inputs;
+        inputs.clear();
+        size_t first = playerInputSnapshots.Size() - std::min(playerInputSnapshots.Size(), kMaxInputsPerPacket);
+        for (size_t idx = first; idx < playerInputSnapshots.Size(); ++idx)
         {
-          // Update
-          float thr = (up ? 1.f : 0.f) + (down ? -1.f : 0.f);
-          float steer = (left ? -1.f : 0.f) + (right ? 1.f : 0.f);
+          const PredictedInput &predicted = playerInputSnapshots[idx];
 
-          // Send
           InputSnapshot input{};
           input.eid = my_entity;
-          input.input_num = inputGen++;
-          input.thr = thr;
-          input.steer = steer;
-          input.dt = dt;
-          input.gen = e.gen;
-          send_entity_input(serverPeer, input);
-
-          playerInputSnapshots.push_back(input);
-
-          e.thr = thr;
-          e.steer = steer;
-          e.gen += gens_passed;
-          simulate_entity(e, dt);
+          input.input_num = predicted.input_num;
+          input.thr = predicted.thr;
+          input.steer = predicted.steer;
+          input.dt = predicted.dt;
+          input.gen = predicted.gen;
+          inputs.push_back(input);
         }
+        send_entity_inputs(serverPeer, inputs);
       }
     }
 
-    interpolate_entities(curTime);
+    if (serverClock.IsSynced())
+      interpolate_entities(interpolator.Advance(serverClock.EstimateTick(now)));
+    report_rollback_stats(curTime);
 
     BeginDrawing();
       ClearBackground(GRAY);
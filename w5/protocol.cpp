@@ -1,64 +1,254 @@
 #include "protocol.h"
-#include <cstring> // memcpy
+#include <bit> // popcount
 
 #include "bitstream.hpp"
+#include "serialization.hpp"
+
+// Wire layouts of the messages, each packet is a MessageType followed by its message schema
+struct ControlledEntityMessage
+{
+  uint16_t eid = invalid_entity;
+};
+
+struct SnapshotAckMessage
+{
+  uint32_t gen = invalid_gen;
+};
+
+struct TimeMessage
+{
+  double clientTime = 0.0;
+  double serverTick = 0.0;
+};
+
+// Followed by count InputRecordSchema records with consecutive input_nums
+struct InputsHeader
+{
+  uint16_t eid = invalid_entity;
+  uint32_t firstInputNum = 0;
+  uint8_t count = 0;
+};
+
+using NewEntitySchema = Schema<Field<&Entity::color>,
+                               Field<&Entity::x>,
+                               Field<&Entity::y>,
+                               Field<&Entity::speed>,
+                               Field<&Entity::ori>,
+                               Field<&Entity::thr>,
+                               Field<&Entity::steer>,
+                               Field<&Entity::eid>,
+                               Field<&Entity::gen>>;
+using ControlledEntitySchema = Schema<Field<&ControlledEntityMessage::eid>>;
+using SnapshotAckSchema = Schema<Field<&SnapshotAckMessage::gen>>;
+using TimeRequestSchema = Schema<Field<&TimeMessage::clientTime>>;
+using TimeResponseSchema = Schema<Field<&TimeMessage::clientTime>, Field<&TimeMessage::serverTick>>;
+using InputsHeaderSchema = Schema<Field<&InputsHeader::eid>,
+                                  Field<&InputsHeader::firstInputNum>,
+                                  Field<&InputsHeader::count>>;
+// Controls are -1, 0 or 1, all of them are exact so the server simulates what the client predicted
+using InputRecordSchema = Schema<Field<&InputSnapshot::gen>,
+                                 QuantizedField<&InputSnapshot::thr, Range{-1.f, 1.f}, 4>,
+                                 QuantizedField<&InputSnapshot::steer, Range{-1.f, 1.f}, 4>,
+                                 Field<&InputSnapshot::dt>>;
+using InputAckSchema = Schema<Field<&InputAck::inputNum>, Field<&InputAck::speed>>;
+// Followed by the uint16_t number of deltas in the chunk
+using WorldSnapshotHeaderSchema = Schema<Field<&WorldSnapshotHeader::gen>,
+                                         Field<&WorldSnapshotHeader::baselineGen>,
+                                         Field<&WorldSnapshotHeader::chunkCount>,
+                                         Field<&WorldSnapshotHeader::firstEid>,
+                                         Field<&WorldSnapshotHeader::lastEid>,
+                                         SchemaField<&WorldSnapshotHeader::inputAck, InputAckSchema>>;
+
+static_assert(NewEntitySchema::kBytes == 34);
+static_assert(ControlledEntitySchema::kBytes == 2);
+static_assert(SnapshotAckSchema::kBytes == 4);
+static_assert(TimeResponseSchema::kBytes == 16);
+static_assert(InputsHeaderSchema::kBytes == 7);
+static_assert(InputRecordSchema::kBits == 72);
+static_assert(WorldSnapshotHeaderSchema::kBytes == 22);
+
+template<typename MessageSchema, typename T>
+static ENetPacket *create_message_packet(MessageType type, const T &message, uint32_t flags)
+{
+  ENetPacket *packet = enet_packet_create(nullptr, sizeof(MessageType) + MessageSchema::kBytes, flags);
+  Bitstream bitstream = Bitstream::Wrap(packet->data, packet->dataLength);
+  bitstream.Write(type);
+  MessageSchema::Write(bitstream, message);
+  return packet;
+}
+
+template<typename MessageSchema, typename T>
+static void read_message(ENetPacket *packet, T &message)
+{
+  Bitstream bitstream{packet->data, packet->dataLength};
+  bitstream.Skip<MessageType>();
+  MessageSchema::Read(bitstream, message);
+}
 
 void send_join(ENetPeer *peer)
 {
-  Bitstream bitstream;
+  ENetPacket *packet = enet_packet_create(nullptr, sizeof(MessageType), ENET_PACKET_FLAG_RELIABLE);
+  Bitstream bitstream = Bitstream::Wrap(packet->data, packet->dataLength);
   bitstream.Write(E_CLIENT_TO_SERVER_JOIN);
 
-  ENetPacket *packet = enet_packet_create(nullptr, bitstream.Size(), ENET_PACKET_FLAG_RELIABLE);
-  bitstream.Read(packet->data, bitstream.Size());
-
   enet_peer_send(peer, 0, packet);
 }
 
 void send_new_entity(ENetPeer *peer, const Entity &ent)
 {
-  Bitstream bitstream;
-  bitstream.Write(E_SERVER_TO_CLIENT_NEW_ENTITY);
-  bitstream.Write(ent);
-
-  ENetPacket *packet = enet_packet_create(nullptr, bitstream.Size(), ENET_PACKET_FLAG_RELIABLE);
-  bitstream.Read(packet->data, bitstream.Size());
-
+  ENetPacket *packet = create_message_packet<NewEntitySchema>(E_SERVER_TO_CLIENT_NEW_ENTITY, ent,
+                                                              ENET_PACKET_FLAG_RELIABLE);
   enet_peer_send(peer, 0, packet);
 }
 
+void broadcast_new_entity(ENetHost *host, const Entity &ent)
+{
+  ENetPacket *packet = create_message_packet<NewEntitySchema>(E_SERVER_TO_CLIENT_NEW_ENTITY, ent,
+                                                              ENET_PACKET_FLAG_RELIABLE);
+  enet_host_broadcast(host, 0, packet);
+}
+
 void send_set_controlled_entity(ENetPeer *peer, uint16_t eid)
 {
-  Bitstream bitstream;
-  bitstream.Write(E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY);
-  bitstream.Write(eid);
+  ENetPacket *packet = create_message_packet<ControlledEntitySchema>(E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY,
+                                                                     ControlledEntityMessage{eid},
+                                                                     ENET_PACKET_FLAG_RELIABLE);
+  enet_peer_send(peer, 0, packet);
+}
 
-  ENetPacket *packet = enet_packet_create(nullptr, bitstream.Size(), ENET_PACKET_FLAG_RELIABLE);
-  bitstream.Read(packet->data, bitstream.Size());
+static constexpr size_t kInputsHeaderSize = sizeof(MessageType) + InputsHeaderSchema::kBytes;
 
-  enet_peer_send(peer, 0, packet);
+static size_t get_inputs_size(size_t count)
+{
+  return kInputsHeaderSize + (count * InputRecordSchema::kBits + 7) / 8;
 }
 
-void send_entity_input(ENetPeer *peer, const InputSnapshot &snapshot)
+void send_entity_inputs(ENetPeer *peer, const std::vector<InputSnapshot> &inputs)
 {
-  Bitstream bitstream;
-  bitstream.Write(E_CLIENT_TO_SERVER_INPUT);
-  bitstream.Write(snapshot);
+  if (inputs.empty())
+    return;
 
-  ENetPacket *packet = enet_packet_create(nullptr, bitstream.Size(), ENET_PACKET_FLAG_RELIABLE);
-  bitstream.Read(packet->data, bitstream.Size());
+  uint8_t count = std::min(inputs.size(), kMaxInputsPerPacket);
+  size_t first = inputs.size() - count;
+
+  ENetPacket *packet = enet_packet_create(nullptr, get_inputs_size(count), ENET_PACKET_FLAG_UNSEQUENCED);
+  Bitstream bitstream = Bitstream::Wrap(packet->data, packet->dataLength);
+  bitstream.Write(E_CLIENT_TO_SERVER_INPUT);
+  InputsHeaderSchema::Write(bitstream, InputsHeader{inputs[first].eid, inputs[first].input_num, count});
+  for (size_t i = first; i < inputs.size(); ++i)
+    InputRecordSchema::Write(bitstream, inputs[i]);
 
   enet_peer_send(peer, 1, packet);
 }
 
-void send_snapshot(ENetPeer *peer, const EntitySnapshot &snapshot)
+static uint8_t get_changed_fields(const EntitySnapshot &snapshot, const EntitySnapshot *baseline)
+{
+  if (baseline == nullptr)
+    return E_SNAPSHOT_FIELD_ALL;
+
+  uint8_t fields = 0;
+  if (snapshot.x != baseline->x)
+    fields |= E_SNAPSHOT_FIELD_X;
+  if (snapshot.y != baseline->y)
+    fields |= E_SNAPSHOT_FIELD_Y;
+  if (snapshot.ori != baseline->ori)
+    fields |= E_SNAPSHOT_FIELD_ORI;
+  return fields;
+}
+
+static size_t get_delta_size(uint8_t fields)
+{
+  return fields == 0 ? 0 : sizeof(uint16_t) + sizeof(uint8_t) + std::popcount(fields) * sizeof(float);
+}
+
+void send_world_snapshot(ENetPeer *peer, uint32_t gen, const std::vector<EntitySnapshot> &snapshots,
+                         uint32_t baselineGen, const std::vector<EntitySnapshot> &baseline,
+                         const InputAck &inputAck)
 {
-  Bitstream bitstream;
-  bitstream.Write(E_SERVER_TO_CLIENT_SNAPSHOT);
-  bitstream.Write(snapshot);
+  constexpr size_t kHeaderSize = sizeof(MessageType) + WorldSnapshotHeaderSchema::kBytes + sizeof(uint16_t);
 
-  ENetPacket *packet = enet_packet_create(nullptr, bitstream.Size(), ENET_PACKET_FLAG_UNSEQUENCED);
-  bitstream.Read(packet->data, bitstream.Size());
+  struct Chunk
+  {
+    size_t end = 0;
+    size_t size = kHeaderSize;
+    uint16_t count = 0;
+  };
 
+  static std::vector<uint8_t> fields;
+  static std::vector<Chunk> chunks;
+
+  if (snapshots.empty())
+    return;
+
+  fields.resize(snapshots.size());
+  chunks.assign(1, Chunk{});
+  for (size_t i = 0; i < snapshots.size(); ++i)
+  {
+    // Entities are only ever appended, so the same entity sits at the same index in the baseline
+    bool hasBaseline = i < baseline.size() && baseline[i].eid == snapshots[i].eid;
+    fields[i] = get_changed_fields(snapshots[i], hasBaseline ? &baseline[i] : nullptr);
+
+    size_t deltaSize = get_delta_size(fields[i]);
+    if (chunks.back().size + deltaSize > kMaxWorldSnapshotPacketSize)
+      chunks.push_back(Chunk{i});
+
+    chunks.back().end = i + 1;
+    chunks.back().size += deltaSize;
+    chunks.back().count += fields[i] != 0;
+  }
+
+  size_t first = 0;
+  for (const Chunk &chunk : chunks)
+  {
+    ENetPacket *packet = enet_packet_create(nullptr, chunk.size, ENET_PACKET_FLAG_UNSEQUENCED);
+    Bitstream bitstream = Bitstream::Wrap(packet->data, packet->dataLength);
+    bitstream.Write(E_SERVER_TO_CLIENT_WORLD_SNAPSHOT);
+    WorldSnapshotHeader header{gen, baselineGen, uint16_t(chunks.size()), snapshots[first].eid,
+                               snapshots[chunk.end - 1].eid, inputAck};
+    WorldSnapshotHeaderSchema::Write(bitstream, header);
+    bitstream.Write(chunk.count);
+
+    for (size_t i = first; i < chunk.end; ++i)
+    {
+      if (fields[i] == 0)
+        continue;
+
+      bitstream.Write(snapshots[i].eid);
+      bitstream.Write(fields[i]);
+      if (fields[i] & E_SNAPSHOT_FIELD_X)
+        bitstream.Write(snapshots[i].x);
+      if (fields[i] & E_SNAPSHOT_FIELD_Y)
+        bitstream.Write(snapshots[i].y);
+      if (fields[i] & E_SNAPSHOT_FIELD_ORI)
+        bitstream.Write(snapshots[i].ori);
+    }
+
+    enet_peer_send(peer, 1, packet);
+    first = chunk.end;
+  }
+}
+
+void send_snapshot_ack(ENetPeer *peer, uint32_t gen)
+{
+  ENetPacket *packet = create_message_packet<SnapshotAckSchema>(E_CLIENT_TO_SERVER_SNAPSHOT_ACK,
+                                                                SnapshotAckMessage{gen},
+                                                                ENET_PACKET_FLAG_UNSEQUENCED);
+  enet_peer_send(peer, 1, packet);
+}
+
+void send_time_request(ENetPeer *peer, double clientTime)
+{
+  ENetPacket *packet = create_message_packet<TimeRequestSchema>(E_CLIENT_TO_SERVER_TIME_REQUEST,
+                                                                TimeMessage{clientTime},
+                                                                ENET_PACKET_FLAG_UNSEQUENCED);
+  enet_peer_send(peer, 1, packet);
+}
+
+void send_time_response(ENetPeer *peer, double clientTime, double serverTick)
+{
+  ENetPacket *packet = create_message_packet<TimeResponseSchema>(E_SERVER_TO_CLIENT_TIME_RESPONSE,
+                                                                 TimeMessage{clientTime, serverTick},
+                                                                 ENET_PACKET_FLAG_UNSEQUENCED);
   enet_peer_send(peer, 1, packet);
 }
 
@@ -69,29 +259,86 @@ MessageType get_packet_type(ENetPacket *packet)
 
 void deserialize_new_entity(ENetPacket *packet, Entity &ent)
 {
-  Bitstream bitstream{packet->data, packet->dataLength};
-  bitstream.Skip<MessageType>();
-  bitstream.Read(ent);
+  ent = Entity{};
+  read_message<NewEntitySchema>(packet, ent);
 }
 
 void deserialize_set_controlled_entity(ENetPacket *packet, uint16_t &eid)
 {
-  Bitstream bitstream{packet->data, packet->dataLength};
-  bitstream.Skip<MessageType>();
-  bitstream.Read(eid);
+  ControlledEntityMessage message;
+  read_message<ControlledEntitySchema>(packet, message);
+  eid = message.eid;
 }
 
-void deserialize_entity_input(ENetPacket *packet, InputSnapshot &snapshot)
+void deserialize_entity_inputs(ENetPacket *packet, std::vector<InputSnapshot> &inputs)
 {
+  inputs.clear();
+  if (packet->dataLength < kInputsHeaderSize)
+    return;
+
   Bitstream bitstream{packet->data, packet->dataLength};
   bitstream.Skip<MessageType>();
-  bitstream.Read(snapshot);
+
+  InputsHeader header;
+  InputsHeaderSchema::Read(bitstream, header);
+  if (header.count > kMaxInputsPerPacket || packet->dataLength < get_inputs_size(header.count))
+    return;
+
+  inputs.resize(header.count);
+  for (uint8_t i = 0; i < header.count; ++i)
+  {
+    InputSnapshot &input = inputs[i];
+    input.eid = header.eid;
+    input.input_num = header.firstInputNum + i;
+    InputRecordSchema::Read(bitstream, input);
+  }
 }
 
-void deserialize_snapshot(ENetPacket *packet, EntitySnapshot &snapshot)
+void deserialize_world_snapshot(ENetPacket *packet, WorldSnapshotHeader &header,
+                                std::vector<EntitySnapshotDelta> &deltas)
 {
   Bitstream bitstream{packet->data, packet->dataLength};
   bitstream.Skip<MessageType>();
-  bitstream.Read(snapshot);
+  WorldSnapshotHeaderSchema::Read(bitstream, header);
+
+  uint16_t count = 0;
+  bitstream.Read(count);
+
+  deltas.resize(count);
+  for (EntitySnapshotDelta &delta : deltas)
+  {
+    delta.snapshot = EntitySnapshot{};
+    delta.snapshot.gen = header.gen;
+    bitstream.Read(delta.snapshot.eid);
+    bitstream.Read(delta.fields);
+    if (delta.fields & E_SNAPSHOT_FIELD_X)
+      bitstream.Read(delta.snapshot.x);
+    if (delta.fields & E_SNAPSHOT_FIELD_Y)
+      bitstream.Read(delta.snapshot.y);
+    if (delta.fields & E_SNAPSHOT_FIELD_ORI)
+      bitstream.Read(delta.snapshot.ori);
+  }
+}
+
+void deserialize_snapshot_ack(ENetPacket *packet, uint32_t &gen)
+{
+  SnapshotAckMessage message;
+  read_message<SnapshotAckSchema>(packet, message);
+  gen = message.gen;
+}
+
+void deserialize_time_request(ENetPacket *packet, double &clientTime)
+{
+  TimeMessage message;
+  read_message<TimeRequestSchema>(packet, message);
+  clientTime = message.clientTime;
+}
+
+void deserialize_time_response(ENetPacket *packet, double &clientTime, double &serverTick)
+{
+  TimeMessage message;
+  read_message<TimeResponseSchema>(packet, message);
+  clientTime = message.clientTime;
+  serverTick = message.serverTick;
 }
 
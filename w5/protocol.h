@@ -1,6 +1,7 @@
 #pragma once
 #include <enet/enet.h>
 #include <cstdint>
+#include <vector>
 #include "entity.h"
 
 enum MessageType : uint8_t
@@ -9,19 +10,82 @@ enum MessageType : uint8_t
   E_SERVER_TO_CLIENT_NEW_ENTITY,
   E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY,
   E_CLIENT_TO_SERVER_INPUT,
-  E_SERVER_TO_CLIENT_SNAPSHOT
+  E_SERVER_TO_CLIENT_WORLD_SNAPSHOT,
+  E_CLIENT_TO_SERVER_SNAPSHOT_ACK,
+  E_CLIENT_TO_SERVER_TIME_REQUEST,
+  E_SERVER_TO_CLIENT_TIME_RESPONSE
+};
+
+// World snapshots are split so that every packet fits into ENet's default MTU (1400)
+constexpr size_t kMaxWorldSnapshotPacketSize = 1200;
+// Clients resend their last unacknowledged inputs in every input packet, so a single packet that
+// gets through fills the gaps left by lost ones
+constexpr size_t kMaxInputsPerPacket = 16;
+
+// Number of last world states the server keeps as delta baselines, clients have to keep at least
+// as many snapshots per entity to decode deltas against any of them
+constexpr uint32_t kSnapshotHistorySize = 64;
+
+// Fields of EntitySnapshot which changed since the baseline and are present on the wire
+enum SnapshotField : uint8_t
+{
+  E_SNAPSHOT_FIELD_X   = 1 << 0,
+  E_SNAPSHOT_FIELD_Y   = 1 << 1,
+  E_SNAPSHOT_FIELD_ORI = 1 << 2,
+  E_SNAPSHOT_FIELD_ALL = E_SNAPSHOT_FIELD_X | E_SNAPSHOT_FIELD_Y | E_SNAPSHOT_FIELD_ORI
+};
+
+// Last input the server applied to the entity controlled by the receiving peer, along with the
+// part of its state snapshots don't carry. Client prediction is checked against it.
+struct InputAck
+{
+  uint32_t inputNum = invalid_input;
+  float speed = 0.f;
+};
+
+// Every chunk of a world snapshot covers the eid range [firstEid, lastEid], entities of that
+// range which have no delta in the chunk are unchanged since baselineGen
+struct WorldSnapshotHeader
+{
+  uint32_t gen = 0;
+  uint32_t baselineGen = invalid_gen;
+  uint16_t chunkCount = 0;
+  uint16_t firstEid = invalid_entity;
+  uint16_t lastEid = invalid_entity;
+  InputAck inputAck;
+};
+
+struct EntitySnapshotDelta
+{
+  EntitySnapshot snapshot;
+  uint8_t fields = 0;
 };
 
 void send_join(ENetPeer *peer);
 void send_new_entity(ENetPeer *peer, const Entity &ent);
+// Encodes the message once and shares the packet between all connected peers
+void broadcast_new_entity(ENetHost *host, const Entity &ent);
 void send_set_controlled_entity(ENetPeer *peer, uint16_t eid);
-void send_entity_input(ENetPeer *peer, const InputSnapshot &snapshot);
-void send_snapshot(ENetPeer *peer, const EntitySnapshot &snapshot);
+// inputs must belong to one entity and have consecutive input_nums, oldest first
+void send_entity_inputs(ENetPeer *peer, const std::vector<InputSnapshot> &inputs);
+// snapshots must be sorted by eid, baseline is the world at baselineGen acknowledged by the peer,
+// pass invalid_gen and an empty baseline to send full states
+void send_world_snapshot(ENetPeer *peer, uint32_t gen, const std::vector<EntitySnapshot> &snapshots,
+                         uint32_t baselineGen, const std::vector<EntitySnapshot> &baseline,
+                         const InputAck &inputAck);
+void send_snapshot_ack(ENetPeer *peer, uint32_t gen);
+// clientTime is echoed back in the response, serverTick is the fractional server tick it was sent at
+void send_time_request(ENetPeer *peer, double clientTime);
+void send_time_response(ENetPeer *peer, double clientTime, double serverTick);
 
 MessageType get_packet_type(ENetPacket *packet);
 
 void deserialize_new_entity(ENetPacket *packet, Entity &ent);
 void deserialize_set_controlled_entity(ENetPacket *packet, uint16_t &eid);
-void deserialize_entity_input(ENetPacket *packet, InputSnapshot &snapshot);
-void deserialize_snapshot(ENetPacket *packet, EntitySnapshot &snapshot);
+void deserialize_entity_inputs(ENetPacket *packet, std::vector<InputSnapshot> &inputs);
+void deserialize_world_snapshot(ENetPacket *packet, WorldSnapshotHeader &header,
+                                std::vector<EntitySnapshotDelta> &deltas);
+void deserialize_snapshot_ack(ENetPacket *packet, uint32_t &gen);
+void deserialize_time_request(ENetPacket *packet, double &clientTime);
+void deserialize_time_response(ENetPacket *packet, double &clientTime, double &serverTick);
 
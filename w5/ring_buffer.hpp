@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+// Fixed capacity FIFO of the last Capacity values, stored inline. Values are expected to be pushed
+// in increasing order of their Key member, which allows lookups by key. Pushing into a full buffer
+// overwrites the oldest value.
+template <typename T, size_t Capacity, auto Key = &T::gen>
+class RingBuffer {
+  static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+  using KeyType = std::remove_cvref_t<decltype(std::declval<const T&>().*Key)>;
+
+  void Push(const T& value) {
+    if (size_ == Capacity) {
+      PopFront();
+    }
+    values_[(head_ + size_) & kMask] = value;
+    ++size_;
+  }
+
+  void PopFront() {
+    head_ = (head_ + 1) & kMask;
+    --size_;
+  }
+
+  // Drops values with keys below key
+  void DropBefore(KeyType key) {
+    while (size_ > 0 && Front().*Key < key) {
+      PopFront();
+    }
+  }
+
+  // Value with the given key, nullptr if it isn't in the buffer
+  const T* Find(KeyType key) const {
+    size_t idx = LowerBound(key);
+    return idx < size_ && (*this)[idx].*Key == key ? &(*this)[idx] : nullptr;
+  }
+
+  // Index of the first value with a key not below key, Size() if there is none
+  size_t LowerBound(KeyType key) const {
+    size_t first = 0;
+    size_t count = size_;
+    while (count > 0) {
+      size_t step = count / 2;
+      if ((*this)[first + step].*Key < key) {
+        first += step + 1;
+        count -= step + 1;
+      } else {
+        count = step;
+      }
+    }
+    return first;
+  }
+
+  void Clear() {
+    head_ = 0;
+    size_ = 0;
+  }
+
+  // Values are indexed from the oldest one
+  T& operator[](size_t idx) { return values_[(head_ + idx) & kMask]; }
+  const T& operator[](size_t idx) const { return values_[(head_ + idx) & kMask]; }
+
+  T& Front() { return (*this)[0]; }
+  const T& Front() const { return (*this)[0]; }
+  T& Back() { return (*this)[size_ - 1]; }
+  const T& Back() const { return (*this)[size_ - 1]; }
+
+  size_t Size() const { return size_; }
+  bool Empty() const { return size_ == 0; }
+  bool Full() const { return size_ == Capacity; }
+  static constexpr size_t GetCapacity() { return Capacity; }
+
+private:
+  static constexpr size_t kMask = Capacity - 1;
+
+  T values_[Capacity]{};
+  size_t head_{0};
+  size_t size_{0};
+};
\ No newline at end of file
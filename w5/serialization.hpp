@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#include "bitstream.hpp"
+
+// Compile-time wire schemas. A schema lists the fields of a struct and how each of them is encoded,
+// Write/Read are generated from it and its size is a constant which can be checked:
+//
+//   using SnapshotSchema = Schema<Field<&EntitySnapshot::eid>,
+//                                 QuantizedField<&EntitySnapshot::x, Range{-16.f, 16.f}, 11>>;
+//   static_assert(SnapshotSchema::kBits == 27);
+//
+// Fields are packed back to back without padding, only what the schema lists goes on the wire.
+
+// Bounds of a quantised float
+struct Range {
+  float lo;
+  float hi;
+};
+
+namespace schema_detail {
+
+template <typename MemberPtr>
+struct MemberPointerTraits;
+
+template <typename Class, typename T>
+struct MemberPointerTraits<T Class::*> {
+  using Type = T;
+};
+
+template <auto Member>
+using MemberType = typename MemberPointerTraits<decltype(Member)>::Type;
+
+}  // namespace schema_detail
+
+// Value copied bit for bit
+template <auto Member>
+struct Field {
+  using Type = schema_detail::MemberType<Member>;
+  static_assert(std::is_trivially_copyable_v<Type>);
+
+  static constexpr size_t kBits = sizeof(Type) * 8;
+
+  template <typename T>
+  static void Write(Bitstream& bitstream, const T& object) {
+    bitstream.Write(object.*Member);
+  }
+
+  template <typename T>
+  static void Read(Bitstream& bitstream, T& object) {
+    bitstream.Read(object.*Member);
+  }
+};
+
+// Unsigned integer or enum stored in its lowest Bits bits, higher ones are dropped
+template <auto Member, uint32_t Bits>
+struct BitsField {
+  using Type = schema_detail::MemberType<Member>;
+  static_assert(std::is_enum_v<Type> || std::is_unsigned_v<Type>);
+  static_assert(Bits > 0 && Bits <= 32 && Bits <= sizeof(Type) * 8);
+
+  static constexpr size_t kBits = Bits;
+
+  template <typename T>
+  static void Write(Bitstream& bitstream, const T& object) {
+    bitstream.WriteBits(static_cast<uint32_t>(object.*Member), Bits);
+  }
+
+  template <typename T>
+  static void Read(Bitstream& bitstream, T& object) {
+    object.*Member = static_cast<Type>(bitstream.ReadBits(Bits));
+  }
+};
+
+// Float clamped to R and quantised to Bits bits. The largest code is left unused so the number of
+// steps is even and the middle of the range (zero of a symmetric one) is represented exactly.
+template <auto Member, Range R, uint32_t Bits>
+struct QuantizedField {
+  static_assert(std::is_same_v<schema_detail::MemberType<Member>, float>);
+  static_assert(R.lo < R.hi);
+  static_assert(Bits >= 2 && Bits <= 24, "float has 24 bits of precision");
+
+  static constexpr size_t kBits = Bits;
+  static constexpr uint32_t kSteps = (1u << Bits) - 2;
+
+  static uint32_t Pack(float value) {
+    // fmin/fmax also map NaN into the range
+    float scaled = (value - R.lo) * (kSteps / (R.hi - R.lo));
+    return static_cast<uint32_t>(std::fmin(std::fmax(scaled, 0.f), float(kSteps)) + 0.5f);
+  }
+
+  static float Unpack(uint32_t code) {
+    float t = static_cast<float>(code < kSteps ? code : kSteps) / kSteps;
+    return R.lo + (R.hi - R.lo) * t;
+  }
+
+  template <typename T>
+  static void Write(Bitstream& bitstream, const T& object) {
+    bitstream.WriteBits(Pack(object.*Member), Bits);
+  }
+
+  template <typename T>
+  static void Read(Bitstream& bitstream, T& object) {
+    object.*Member = Unpack(bitstream.ReadBits(Bits));
+  }
+};
+
+// Nested struct encoded with its own schema
+template <auto Member, typename MemberSchema>
+struct SchemaField {
+  static constexpr size_t kBits = MemberSchema::kBits;
+
+  template <typename T>
+  static void Write(Bitstream& bitstream, const T& object) {
+    MemberSchema::Write(bitstream, object.*Member);
+  }
+
+  template <typename T>
+  static void Read(Bitstream& bitstream, T& object) {
+    MemberSchema::Read(bitstream, object.*Member);
+  }
+};
+
+template <typename... Fields>
+struct Schema {
+  static constexpr size_t kBits = (Fields::kBits + ... + 0);
+  static constexpr size_t kBytes = (kBits + 7) / 8;
+
+  template <typename T>
+  static void Write(Bitstream& bitstream, const T& object) {
+    (Fields::Write(bitstream, object), ...);
+  }
+
+  template <typename T>
+  static void Read(Bitstream& bitstream, T& object) {
+    (Fields::Read(bitstream, object), ...);
+  }
+};
\ No newline at end of file
@@ -1,17 +1,35 @@
 #include <enet/enet.h>
 #include <iostream>
 #include "entity.h"
+#include "entity_registry.hpp"
 #include "protocol.h"
+#include "packet_pool.hpp"
 #include "mathUtils.h"
+#include "input_buffer.hpp"
 #include <stdlib.h>
 #include <vector>
-#include <map>
 
 #include "time.hpp"
 
-static std::vector<Entity> entities;
-static std::map<uint16_t, ENetPeer*> controlledMap;
-static std::map<uint16_t, std::vector<InputSnapshot>> inputQueues;
+static EntityRegistry<Entity> entities;
+// Peer controlling each entity
+static EidMap<ENetPeer*> controlledMap;
+// Inputs received for each entity, played back one tick of client time per tick
+static EidMap<InputJitterBuffer> inputBuffers;
+// Last input applied to each entity
+static EidMap<uint32_t> lastInputNums;
+// Entity controlled by each peer, indexed as host->peers
+static std::vector<EntityHandle> peerEntities;
+
+// World states of the last gens, used as delta compression baselines
+static std::vector<EntitySnapshot> snapshotHistory[kSnapshotHistorySize];
+static uint32_t worldGen = 0;
+// When worldGen was simulated, time requests are answered with the fractional tick since then
+static TickScheduler::Clock::time_point worldGenTime = TickScheduler::Clock::now();
+// Last gen acknowledged by each peer, indexed as host->peers
+static std::vector<uint32_t> ackedGens;
+
+constexpr float kTickDt = std::chrono::duration<float>(kServerTickPeriod).count();
 
 void on_join(ENetPacket *packet, ENetPeer *peer, ENetHost *host)
 {
@@ -20,9 +38,9 @@ void on_join(ENetPacket *packet, ENetPeer *peer, ENetHost *host)
     send_new_entity(peer, ent);
 
   // find max eid
-  uint16_t maxEid = entities.empty() ? invalid_entity : entities[0].eid;
-  for (const Entity &e : entities)
-    maxEid = std::max(maxEid, e.eid);
+  uint16_t maxEid = entities.Empty() ? invalid_entity : entities.Eids()[0];
+  for (uint16_t eid : entities.Eids())
+    maxEid = std::max(maxEid, eid);
   uint16_t newEid = maxEid + 1;
   uint32_t color = 0xff000000 +
                    0x00440000 * (rand() % 5) +
@@ -30,30 +48,113 @@ void on_join(ENetPacket *packet, ENetPeer *peer, ENetHost *host)
                    0x00000044 * (rand() % 5);
   float x = (rand() % 4) * 5.f;
   float y = (rand() % 4) * 5.f;
-  Entity ent = {color, x, y, 0.f, (rand() / RAND_MAX) * 3.141592654f, 0.f, 0.f, newEid};
-  entities.push_back(ent);
+  Entity ent = {color, x, y, 0.f, (rand() / RAND_MAX) * 3.141592654f, 0.f, 0.f, newEid, worldGen};
+  entities.Add(newEid, ent);
 
   controlledMap[newEid] = peer;
+  lastInputNums[newEid] = invalid_input;
+  inputBuffers[newEid] = InputJitterBuffer();
+  peerEntities[peer - host->peers] = entities.GetHandle(newEid);
 
 
   // send info about new entity to everyone
-  for (size_t i = 0; i < host->peerCount; ++i)
-    send_new_entity(&host->peers[i], ent);
+  broadcast_new_entity(host, ent);
   // send info about controlled entity
   send_set_controlled_entity(peer, newEid);
 }
 
-void on_input(ENetPacket *packet)
+void on_input(ENetPacket *packet, ENetPeer *peer)
 {
-  InputSnapshot input{};
-  deserialize_entity_input(packet, input);
+  static std::vector<InputSnapshot> inputs;
+  deserialize_entity_inputs(packet, inputs);
+  if (inputs.empty() || controlledMap.Get(inputs[0].eid) != peer)
+    return;
 
-  inputQueues[input.eid].push_back(input);
+  double arrivalTime = std::chrono::duration<double>(TickScheduler::Clock::now().time_since_epoch()).count();
+  inputBuffers[inputs[0].eid].Receive(inputs, arrivalTime);
+}
+
+void on_snapshot_ack(ENetPacket *packet, ENetPeer *peer, ENetHost *host)
+{
+  uint32_t gen = invalid_gen;
+  deserialize_snapshot_ack(packet, gen);
+  if (gen > worldGen)
+    return;
+
+  uint32_t &ackedGen = ackedGens[peer - host->peers];
+  if (ackedGen == invalid_gen || gen > ackedGen)
+    ackedGen = gen;
+}
+
+void on_time_request(ENetPacket *packet, ENetPeer *peer)
+{
+  double clientTime = 0.0;
+  deserialize_time_request(packet, clientTime);
+
+  double sinceTick = std::chrono::duration<double>(TickScheduler::Clock::now() - worldGenTime) / kServerTickPeriod;
+  send_time_response(peer, clientTime, worldGen + std::min(sinceTick, 1.0));
+}
+
+void update_world(ENetHost *server)
+{
+  ++worldGen;
+  worldGenTime = TickScheduler::Clock::now();
+  std::vector<EntitySnapshot> &snapshots = snapshotHistory[worldGen % kSnapshotHistorySize];
+  snapshots.clear();
+  static std::vector<InputSnapshot> inputs;
+  for (Entity &e : entities)
+  {
+    // simulate
+    inputs.clear();
+    inputBuffers[e.eid].Consume(kTickDt, inputs);
+    for (const auto& input : inputs) {
+      e.thr = input.thr;
+      e.steer = input.steer;
+      simulate_entity(e, input.dt);
+      lastInputNums[e.eid] = input.input_num;
+    }
+
+    e.gen = worldGen;
+
+    EntitySnapshot snapshot{};
+    snapshot.x = e.x;
+    snapshot.y = e.y;
+    snapshot.ori = e.ori;
+    snapshot.eid = e.eid;
+    snapshot.gen = e.gen;
+    snapshots.push_back(snapshot);
+  }
+
+  // send, delta-compressed against the last world state each peer has acknowledged
+  static const std::vector<EntitySnapshot> noBaseline;
+  for (size_t i = 0; i < server->peerCount; ++i)
+  {
+    // Snapshots are personalised, nothing is encoded for empty slots
+    if (server->peers[i].state != ENET_PEER_STATE_CONNECTED)
+      continue;
+
+    uint32_t baselineGen = ackedGens[i];
+    if (baselineGen != invalid_gen && worldGen - baselineGen >= kSnapshotHistorySize)
+      baselineGen = invalid_gen;
+
+    const std::vector<EntitySnapshot> &baseline = baselineGen != invalid_gen
+                                                  ? snapshotHistory[baselineGen % kSnapshotHistorySize]
+                                                  : noBaseline;
+    InputAck inputAck;
+    if (const Entity *controlled = entities.Find(peerEntities[i]))
+    {
+      inputAck.inputNum = lastInputNums.Get(controlled->eid);
+      inputAck.speed = controlled->speed;
+    }
+
+    send_world_snapshot(&server->peers[i], worldGen, snapshots, baselineGen, baseline, inputAck);
+  }
 }
 
 int main(int argc, const char **argv)
 {
-  if (enet_initialize() != 0)
+  // Snapshots allocate packets for every peer every tick, they are recycled instead of malloc'ed
+  if (enet_initialize_with_packet_pool() != 0)
   {
     printf("Cannot init ENet");
     return 1;
@@ -71,19 +172,23 @@ int main(int argc, const char **argv)
     return 1;
   }
 
+  ackedGens.assign(server->peerCount, invalid_gen);
+  peerEntities.resize(server->peerCount);
+
   printf("Server's fixed update is every %lu ms (%lu times per second)\n", kServerFixedTimeStep, kServerUpdatesPerSecond);
 
+  TickScheduler scheduler(kServerTickPeriod);
   while (true)
   {
-    uint32_t curTime = enet_time_get();
-
+    // wait for network events until the next tick is due
     ENetEvent event;
-    while (enet_host_service(server, &event, 0) > 0)
+    while (enet_host_service(server, &event, scheduler.TimeUntilNextTickMs()) > 0)
     {
       switch (event.type)
       {
       case ENET_EVENT_TYPE_CONNECT:
         printf("Connection with %x:%u established\n", event.peer->address.host, event.peer->address.port);
+        ackedGens[event.peer - server->peers] = invalid_gen;
         break;
       case ENET_EVENT_TYPE_RECEIVE:
         switch (get_packet_type(event.packet))
@@ -92,7 +197,13 @@ int main(int argc, const char **argv)
             on_join(event.packet, event.peer, server);
             break;
           case E_CLIENT_TO_SERVER_INPUT:
-            on_input(event.packet);
+            on_input(event.packet, event.peer);
+            break;
+          case E_CLIENT_TO_SERVER_SNAPSHOT_ACK:
+            on_snapshot_ack(event.packet, event.peer, server);
+            break;
+          case E_CLIENT_TO_SERVER_TIME_REQUEST:
+            on_time_request(event.packet, event.peer);
             break;
         };
         enet_packet_destroy(event.packet);
@@ -102,35 +213,12 @@ int main(int argc, const char **argv)
       };
     }
 
-    for (Entity &e : entities)
+    for (uint32_t ticks = scheduler.ConsumeDueTicks(); ticks > 0; --ticks)
     {
-      // simulate
-      for (const auto& input : inputQueues[e.eid]) {
-        e.thr = input.thr;
-        e.steer = input.steer;
-        simulate_entity(e, input.dt);
-      }
-
-      inputQueues[e.eid].clear();
-      
-      ++e.gen;
-
-      // send
-      for (size_t i = 0; i < server->peerCount; ++i)
-      {
-        ENetPeer *peer = &server->peers[i];
-
-        EntitySnapshot snapshot{};
-        snapshot.x = e.x;
-        snapshot.y = e.y;
-        snapshot.ori = e.ori;
-        snapshot.eid = e.eid;
-        snapshot.gen = e.gen;
-        send_snapshot(peer, snapshot);
-      }
+      scheduler.BeginTick();
+      update_world(server);
+      scheduler.EndTick();
     }
-
-    usleep(kServerFixedTimeStep * 1000u);
   }
 
   enet_host_destroy(server);
@@ -1,7 +1,107 @@
 #pragma once
 
+#include <algorithm>
+#include <chrono>
 #include <cstdint>
+#include <cstdio>
 
 constexpr uint32_t kServerUpdatesPerSecond = 32;
 constexpr uint32_t kServerFixedTimeStep    = (1000.0f / kServerUpdatesPerSecond);  // In ms
-constexpr float    kServerFixedTimeStepF   = kServerFixedTimeStep;                 // In ms
\ No newline at end of file
+constexpr float    kServerFixedTimeStepF   = kServerFixedTimeStep;                 // In ms
+
+constexpr std::chrono::nanoseconds kServerTickPeriod = std::chrono::nanoseconds(std::chrono::seconds(1)) / kServerUpdatesPerSecond;
+
+// Fixed timestep scheduler on a monotonic clock. Ticks are due at start + n * period regardless of
+// how long each of them took, so the rate doesn't drift. After a stall at most max_catch_up ticks
+// are run back to back, older ones are dropped.
+class TickScheduler {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  explicit TickScheduler(Clock::duration period, uint32_t max_catch_up = 4,
+                         Clock::duration report_period = std::chrono::seconds(10))
+      : period_(period), max_catch_up_(max_catch_up), report_period_(report_period),
+        next_tick_(Clock::now()), report_start_(next_tick_) {}
+
+  // Time left until the next tick is due rounded up, suitable as a wait timeout
+  uint32_t TimeUntilNextTickMs() const {
+    Clock::time_point now = Clock::now();
+    if (now >= next_tick_) {
+      return 0;
+    }
+    return static_cast<uint32_t>(std::chrono::ceil<std::chrono::milliseconds>(next_tick_ - now).count());
+  }
+
+  // Returns the number of ticks to run now and moves the schedule past them
+  uint32_t ConsumeDueTicks() {
+    Clock::time_point now = Clock::now();
+    if (now < next_tick_) {
+      return 0;
+    }
+
+    uint64_t due = (now - next_tick_) / period_ + 1;
+    next_tick_ += period_ * due;
+
+    if (due > max_catch_up_) {
+      skipped_ticks_ += due - max_catch_up_;
+      due = max_catch_up_;
+    }
+    late_ticks_ += due - 1;
+
+    return static_cast<uint32_t>(due);
+  }
+
+  void BeginTick() { tick_start_ = Clock::now(); }
+
+  // Accounts the work of the tick and prints statistics once per report period
+  void EndTick() {
+    Clock::time_point now = Clock::now();
+    Clock::duration work = now - tick_start_;
+
+    ++ticks_;
+    total_work_ += work;
+    max_work_ = std::max(max_work_, work);
+    overrun_ticks_ += work > period_;
+
+    if (now - report_start_ >= report_period_) {
+      PrintStats(now);
+    }
+  }
+
+private:
+  void PrintStats(Clock::time_point now) {
+    using MsF = std::chrono::duration<double, std::milli>;
+    double seconds = std::chrono::duration<double>(now - report_start_).count();
+
+    printf("Ticks: %.1f/s, work avg %.3f ms max %.3f ms, overran %lu, late %lu, skipped %lu\n",
+           ticks_ / seconds, MsF(total_work_).count() / std::max<uint64_t>(ticks_, 1), MsF(max_work_).count(),
+           (unsigned long)overrun_ticks_, (unsigned long)late_ticks_, (unsigned long)skipped_ticks_);
+
+    report_start_ = now;
+    ticks_ = 0;
+    total_work_ = Clock::duration::zero();
+    max_work_ = Clock::duration::zero();
+    overrun_ticks_ = 0;
+    late_ticks_ = 0;
+    skipped_ticks_ = 0;
+  }
+
+  Clock::duration period_;
+  uint32_t max_catch_up_;
+  Clock::duration report_period_;
+
+  Clock::time_point next_tick_;
+  Clock::time_point tick_start_;
+  Clock::time_point report_start_;
+
+  // Statistics of the current report period
+  uint64_t ticks_{0};
+  Clock::duration total_work_{Clock::duration::zero()};
+  Clock::duration max_work_{Clock::duration::zero()};
+  // Ticks whose work took longer than the period
+  uint64_t overrun_ticks_{0};
+  // Ticks run back to back to catch up with the schedule
+  uint64_t late_ticks_{0};
+  // Ticks dropped beyond max_catch_up
+  uint64_t skipped_ticks_{0};
+};
\ No newline at end of file
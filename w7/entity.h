@@ -14,5 +14,13 @@ struct Entity
   uint16_t eid = invalid_entity;
 };
 
+struct EntitySnapshot
+{
+  uint16_t eid = invalid_entity;
+  float x = 0.f;
+  float y = 0.f;
+  float ori = 0.f;
+};
+
 void simulate_entity(Entity &e, float dt);
 
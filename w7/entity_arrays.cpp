@@ -0,0 +1,297 @@
+#include "entity_arrays.hpp"
+
+#include <cmath>
+#include <cstdint>
+
+#include "mathUtils.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define ENTITY_ARRAYS_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(ENTITY_ARRAYS_SSE2) && (defined(__GNUC__) || defined(__clang__))
+#define ENTITY_ARRAYS_AVX2
+#include <immintrin.h>
+#endif
+
+void EntityArrays::Add(const Entity& entity) {
+  x.push_back(entity.x);
+  y.push_back(entity.y);
+  speed.push_back(entity.speed);
+  ori.push_back(entity.ori);
+  thr.push_back(entity.thr);
+  steer.push_back(entity.steer);
+}
+
+void EntityArrays::Load(size_t idx, Entity& entity) const {
+  entity.x = x[idx];
+  entity.y = y[idx];
+  entity.speed = speed[idx];
+  entity.ori = ori[idx];
+  entity.thr = thr[idx];
+  entity.steer = steer[idx];
+}
+
+EntitySpan EntityArrays::Span(size_t first, size_t count) {
+  return EntitySpan{x.data() + first,   y.data() + first,   speed.data() + first,
+                    ori.data() + first, thr.data() + first, steer.data() + first,
+                    count};
+}
+
+//------------------------------------------------------------------------------------------------
+// sin/cos: angle is reduced to r in [-PI/4, PI/4] by a multiple j of PI/2 (split in three parts
+// so the reduction is exact for |angle| < 2^13), then cephes minimax polynomials are evaluated
+// and the quadrant j & 3 picks and negates them. Every path below performs exactly the same
+// float operations in the same order.
+static constexpr float k2OverPi = 0.636619772f;
+static constexpr float kPiOver2Hi = 1.5703125f;
+static constexpr float kPiOver2Mid = 4.837512969970703125e-4f;
+static constexpr float kPiOver2Lo = 7.54978995489188216e-8f;
+
+static constexpr float kSin1 = -1.6666654611e-1f;
+static constexpr float kSin2 = 8.3321608736e-3f;
+static constexpr float kSin3 = -1.9515295891e-4f;
+static constexpr float kCos1 = 4.166664568298827e-2f;
+static constexpr float kCos2 = -1.388731625493765e-3f;
+static constexpr float kCos3 = 2.443315711809948e-5f;
+
+static inline void sincos_approx(float angle, float& out_sin, float& out_cos) {
+  float j = std::nearbyint(angle * k2OverPi);
+  int32_t quadrant = static_cast<int32_t>(j) & 3;
+
+  float r = ((angle - j * kPiOver2Hi) - j * kPiOver2Mid) - j * kPiOver2Lo;
+  float r2 = r * r;
+  float s = r + (r * r2) * ((kSin3 * r2 + kSin2) * r2 + kSin1);
+  float c = (1.0f - 0.5f * r2) + (r2 * r2) * ((kCos3 * r2 + kCos2) * r2 + kCos1);
+
+  out_sin = (quadrant & 1) ? c : s;
+  out_cos = (quadrant & 1) ? s : c;
+  if (quadrant & 2) {
+    out_sin = -out_sin;
+  }
+  if ((quadrant + 1) & 2) {
+    out_cos = -out_cos;
+  }
+}
+
+// Same car model as simulate_entity
+static inline void simulate_element(const EntitySpan& span, size_t i, float dt) {
+  float speed = span.speed[i];
+  float thr = span.thr[i];
+
+  bool isBraking = sign(thr) != 0.f && sign(thr) != sign(speed);
+  float accel = isBraking ? 12.f : 3.f;
+  speed = move_to(speed, clamp(thr, -0.3f, 1.f) * 10.f, dt, accel);
+
+  float ori = span.ori[i] + span.steer[i] * dt * clamp(speed, -2.f, 2.f) * 0.3f;
+  ori = ori + (ori > PI ? -2.f * PI : ori < -PI ? 2.f * PI : 0.f);
+
+  float s = 0.f;
+  float c = 0.f;
+  sincos_approx(ori, s, c);
+
+  span.x[i] += c * speed * dt;
+  span.y[i] += s * speed * dt;
+  span.speed[i] = speed;
+  span.ori[i] = ori;
+}
+
+static void simulate_range_scalar(const EntitySpan& span, size_t first, float dt) {
+  for (size_t i = first; i < span.count; ++i) {
+    simulate_element(span, i, dt);
+  }
+}
+
+void simulate_entities_scalar(const EntitySpan& span, float dt) {
+  simulate_range_scalar(span, 0, dt);
+}
+
+#ifdef ENTITY_ARRAYS_SSE2
+static void simulate_entities_sse2(const EntitySpan& span, float dt) {
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.f);
+  const __m128 signMask = _mm_set1_ps(-0.f);
+  const __m128 dtv = _mm_set1_ps(dt);
+  const __m128 pi = _mm_set1_ps(PI);
+  const __m128 minusPi = _mm_set1_ps(-PI);
+
+  size_t i = 0;
+  for (; i + 4 <= span.count; i += 4) {
+    __m128 speed = _mm_loadu_ps(span.speed + i);
+    __m128 thr = _mm_loadu_ps(span.thr + i);
+
+    // isBraking = sign(thr) != 0 && sign(thr) != sign(speed)
+    __m128 braking = _mm_or_ps(_mm_andnot_ps(_mm_cmpgt_ps(speed, zero), _mm_cmpgt_ps(thr, zero)),
+                               _mm_andnot_ps(_mm_cmplt_ps(speed, zero), _mm_cmplt_ps(thr, zero)));
+    __m128 accel = _mm_or_ps(_mm_and_ps(braking, _mm_set1_ps(12.f)), _mm_andnot_ps(braking, _mm_set1_ps(3.f)));
+
+    // move_to(speed, clamp(thr, -0.3, 1) * 10, dt, accel)
+    __m128 target = _mm_mul_ps(_mm_min_ps(_mm_max_ps(thr, _mm_set1_ps(-0.3f)), one), _mm_set1_ps(10.f));
+    __m128 d = _mm_mul_ps(accel, dtv);
+    __m128 reached = _mm_cmplt_ps(_mm_andnot_ps(signMask, _mm_sub_ps(speed, target)), d);
+    __m128 down = _mm_cmplt_ps(target, speed);
+    __m128 moved = _mm_or_ps(_mm_and_ps(down, _mm_sub_ps(speed, d)), _mm_andnot_ps(down, _mm_add_ps(speed, d)));
+    speed = _mm_or_ps(_mm_and_ps(reached, target), _mm_andnot_ps(reached, moved));
+
+    __m128 clampedSpeed = _mm_min_ps(_mm_max_ps(speed, _mm_set1_ps(-2.f)), _mm_set1_ps(2.f));
+    __m128 turn = _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(span.steer + i), dtv), clampedSpeed),
+                             _mm_set1_ps(0.3f));
+    __m128 ori = _mm_add_ps(_mm_loadu_ps(span.ori + i), turn);
+    __m128 wrap = _mm_or_ps(_mm_and_ps(_mm_cmpgt_ps(ori, pi), _mm_set1_ps(-2.f * PI)),
+                            _mm_and_ps(_mm_andnot_ps(_mm_cmpgt_ps(ori, pi), _mm_cmplt_ps(ori, minusPi)),
+                                       _mm_set1_ps(2.f * PI)));
+    ori = _mm_add_ps(ori, wrap);
+
+    // sincos_approx
+    __m128i ji = _mm_cvtps_epi32(_mm_mul_ps(ori, _mm_set1_ps(k2OverPi)));
+    __m128 j = _mm_cvtepi32_ps(ji);
+    __m128i quadrant = _mm_and_si128(ji, _mm_set1_epi32(3));
+
+    __m128 r = _mm_sub_ps(ori, _mm_mul_ps(j, _mm_set1_ps(kPiOver2Hi)));
+    r = _mm_sub_ps(r, _mm_mul_ps(j, _mm_set1_ps(kPiOver2Mid)));
+    r = _mm_sub_ps(r, _mm_mul_ps(j, _mm_set1_ps(kPiOver2Lo)));
+    __m128 r2 = _mm_mul_ps(r, r);
+
+    __m128 s = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(kSin3), r2), _mm_set1_ps(kSin2));
+    s = _mm_add_ps(_mm_mul_ps(s, r2), _mm_set1_ps(kSin1));
+    s = _mm_add_ps(r, _mm_mul_ps(_mm_mul_ps(r, r2), s));
+
+    __m128 c = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(kCos3), r2), _mm_set1_ps(kCos2));
+    c = _mm_add_ps(_mm_mul_ps(c, r2), _mm_set1_ps(kCos1));
+    c = _mm_add_ps(_mm_sub_ps(one, _mm_mul_ps(_mm_set1_ps(0.5f), r2)), _mm_mul_ps(_mm_mul_ps(r2, r2), c));
+
+    __m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(quadrant, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+    __m128 negSin = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(quadrant, _mm_set1_epi32(2)), 30));
+    __m128 negCos = _mm_castsi128_ps(
+        _mm_slli_epi32(_mm_and_si128(_mm_add_epi32(quadrant, _mm_set1_epi32(1)), _mm_set1_epi32(2)), 30));
+    __m128 sinOri = _mm_xor_ps(_mm_or_ps(_mm_and_ps(swap, c), _mm_andnot_ps(swap, s)), negSin);
+    __m128 cosOri = _mm_xor_ps(_mm_or_ps(_mm_and_ps(swap, s), _mm_andnot_ps(swap, c)), negCos);
+
+    __m128 x = _mm_add_ps(_mm_loadu_ps(span.x + i), _mm_mul_ps(_mm_mul_ps(cosOri, speed), dtv));
+    __m128 y = _mm_add_ps(_mm_loadu_ps(span.y + i), _mm_mul_ps(_mm_mul_ps(sinOri, speed), dtv));
+
+    _mm_storeu_ps(span.x + i, x);
+    _mm_storeu_ps(span.y + i, y);
+    _mm_storeu_ps(span.speed + i, speed);
+    _mm_storeu_ps(span.ori + i, ori);
+  }
+
+  simulate_range_scalar(span, i, dt);
+}
+#endif
+
+#ifdef ENTITY_ARRAYS_AVX2
+__attribute__((target("avx2"))) static void simulate_entities_avx2(const EntitySpan& span, float dt) {
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 one = _mm256_set1_ps(1.f);
+  const __m256 signMask = _mm256_set1_ps(-0.f);
+  const __m256 dtv = _mm256_set1_ps(dt);
+  const __m256 pi = _mm256_set1_ps(PI);
+  const __m256 minusPi = _mm256_set1_ps(-PI);
+
+  size_t i = 0;
+  for (; i + 8 <= span.count; i += 8) {
+    __m256 speed = _mm256_loadu_ps(span.speed + i);
+    __m256 thr = _mm256_loadu_ps(span.thr + i);
+
+    // isBraking = sign(thr) != 0 && sign(thr) != sign(speed)
+    __m256 braking = _mm256_or_ps(
+        _mm256_andnot_ps(_mm256_cmp_ps(speed, zero, _CMP_GT_OQ), _mm256_cmp_ps(thr, zero, _CMP_GT_OQ)),
+        _mm256_andnot_ps(_mm256_cmp_ps(speed, zero, _CMP_LT_OQ), _mm256_cmp_ps(thr, zero, _CMP_LT_OQ)));
+    __m256 accel = _mm256_blendv_ps(_mm256_set1_ps(3.f), _mm256_set1_ps(12.f), braking);
+
+    // move_to(speed, clamp(thr, -0.3, 1) * 10, dt, accel)
+    __m256 target = _mm256_mul_ps(_mm256_min_ps(_mm256_max_ps(thr, _mm256_set1_ps(-0.3f)), one),
+                                  _mm256_set1_ps(10.f));
+    __m256 d = _mm256_mul_ps(accel, dtv);
+    __m256 reached = _mm256_cmp_ps(_mm256_andnot_ps(signMask, _mm256_sub_ps(speed, target)), d, _CMP_LT_OQ);
+    __m256 down = _mm256_cmp_ps(target, speed, _CMP_LT_OQ);
+    __m256 moved = _mm256_blendv_ps(_mm256_add_ps(speed, d), _mm256_sub_ps(speed, d), down);
+    speed = _mm256_blendv_ps(moved, target, reached);
+
+    __m256 clampedSpeed = _mm256_min_ps(_mm256_max_ps(speed, _mm256_set1_ps(-2.f)), _mm256_set1_ps(2.f));
+    __m256 turn = _mm256_mul_ps(
+        _mm256_mul_ps(_mm256_mul_ps(_mm256_loadu_ps(span.steer + i), dtv), clampedSpeed), _mm256_set1_ps(0.3f));
+    __m256 ori = _mm256_add_ps(_mm256_loadu_ps(span.ori + i), turn);
+    __m256 wrap = _mm256_blendv_ps(
+        _mm256_and_ps(_mm256_cmp_ps(ori, minusPi, _CMP_LT_OQ), _mm256_set1_ps(2.f * PI)),
+        _mm256_set1_ps(-2.f * PI), _mm256_cmp_ps(ori, pi, _CMP_GT_OQ));
+    ori = _mm256_add_ps(ori, wrap);
+
+    // sincos_approx
+    __m256i ji = _mm256_cvtps_epi32(_mm256_mul_ps(ori, _mm256_set1_ps(k2OverPi)));
+    __m256 j = _mm256_cvtepi32_ps(ji);
+    __m256i quadrant = _mm256_and_si256(ji, _mm256_set1_epi32(3));
+
+    __m256 r = _mm256_sub_ps(ori, _mm256_mul_ps(j, _mm256_set1_ps(kPiOver2Hi)));
+    r = _mm256_sub_ps(r, _mm256_mul_ps(j, _mm256_set1_ps(kPiOver2Mid)));
+    r = _mm256_sub_ps(r, _mm256_mul_ps(j, _mm256_set1_ps(kPiOver2Lo)));
+    __m256 r2 = _mm256_mul_ps(r, r);
+
+    __m256 s = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(kSin3), r2), _mm256_set1_ps(kSin2));
+    s = _mm256_add_ps(_mm256_mul_ps(s, r2), _mm256_set1_ps(kSin1));
+    s = _mm256_add_ps(r, _mm256_mul_ps(_mm256_mul_ps(r, r2), s));
+
+    __m256 c = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(kCos3), r2), _mm256_set1_ps(kCos2));
+    c = _mm256_add_ps(_mm256_mul_ps(c, r2), _mm256_set1_ps(kCos1));
+    c = _mm256_add_ps(_mm256_sub_ps(one, _mm256_mul_ps(_mm256_set1_ps(0.5f), r2)),
+                      _mm256_mul_ps(_mm256_mul_ps(r2, r2), c));
+
+    __m256 swap = _mm256_castsi256_ps(
+        _mm256_cmpeq_epi32(_mm256_and_si256(quadrant, _mm256_set1_epi32(1)), _mm256_set1_epi32(1)));
+    __m256 negSin = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(quadrant, _mm256_set1_epi32(2)), 30));
+    __m256 negCos = _mm256_castsi256_ps(_mm256_slli_epi32(
+        _mm256_and_si256(_mm256_add_epi32(quadrant, _mm256_set1_epi32(1)), _mm256_set1_epi32(2)), 30));
+    __m256 sinOri = _mm256_xor_ps(_mm256_blendv_ps(s, c, swap), negSin);
+    __m256 cosOri = _mm256_xor_ps(_mm256_blendv_ps(c, s, swap), negCos);
+
+    __m256 x = _mm256_add_ps(_mm256_loadu_ps(span.x + i), _mm256_mul_ps(_mm256_mul_ps(cosOri, speed), dtv));
+    __m256 y = _mm256_add_ps(_mm256_loadu_ps(span.y + i), _mm256_mul_ps(_mm256_mul_ps(sinOri, speed), dtv));
+
+    _mm256_storeu_ps(span.x + i, x);
+    _mm256_storeu_ps(span.y + i, y);
+    _mm256_storeu_ps(span.speed + i, speed);
+    _mm256_storeu_ps(span.ori + i, ori);
+  }
+
+  simulate_range_scalar(span, i, dt);
+}
+
+static bool has_avx2() {
+  static const bool kHasAvx2 = []() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+  }();
+  return kHasAvx2;
+}
+#endif
+
+void simulate_entities(const EntitySpan& span, float dt) {
+#if defined(ENTITY_ARRAYS_AVX2)
+  if (has_avx2()) {
+    simulate_entities_avx2(span, dt);
+    return;
+  }
+#endif
+
+#if defined(ENTITY_ARRAYS_SSE2)
+  simulate_entities_sse2(span, dt);
+#else
+  simulate_entities_scalar(span, dt);
+#endif
+}
+
+const char* simulate_entities_isa() {
+#if defined(ENTITY_ARRAYS_AVX2)
+  if (has_avx2()) {
+    return "avx2";
+  }
+#endif
+
+#if defined(ENTITY_ARRAYS_SSE2)
+  return "sse2";
+#else
+  return "scalar";
+#endif
+}
\ No newline at end of file
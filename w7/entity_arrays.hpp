@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "entity.h"
+
+// Simulated state of count entities, i-th element of every array belongs to the same entity
+struct EntitySpan {
+  float* x;
+  float* y;
+  float* speed;
+  float* ori;
+  float* thr;
+  float* steer;
+  size_t count;
+};
+
+// Structure of arrays storage of the simulated part of Entity
+class EntityArrays {
+public:
+  size_t Size() const { return x.size(); }
+
+  void Add(const Entity& entity);
+  // Copies simulated state of the idx-th entity into entity
+  void Load(size_t idx, Entity& entity) const;
+
+  EntitySpan Span(size_t first, size_t count);
+  EntitySpan Span() { return Span(0, Size()); }
+
+  std::vector<float> x;
+  std::vector<float> y;
+  std::vector<float> speed;
+  std::vector<float> ori;
+  std::vector<float> thr;
+  std::vector<float> steer;
+};
+
+// Batched simulate_entity, vectorised with AVX2 or SSE2 when the CPU has them. Trigonometry is a
+// polynomial approximation (error ~1e-7), shared with the scalar path so every path produces
+// bit-identical results.
+void simulate_entities(const EntitySpan& span, float dt);
+// Portable implementation of simulate_entities
+void simulate_entities_scalar(const EntitySpan& span, float dt);
+// Instruction set simulate_entities runs on: "avx2", "sse2" or "scalar"
+const char* simulate_entities_isa();
\ No newline at end of file
@@ -0,0 +1,115 @@
+#include "job_system.hpp"
+
+#include <algorithm>
+
+uint32_t JobSystem::DefaultWorkerCount() {
+  uint32_t cores = std::thread::hardware_concurrency();
+  return cores > 1 ? cores - 1 : 0;
+}
+
+JobSystem::JobSystem(uint32_t worker_count) {
+  for (uint32_t i = 0; i <= worker_count; ++i) {
+    queues_.push_back(std::make_unique<WorkQueue>());
+  }
+
+  for (uint32_t i = 1; i <= worker_count; ++i) {
+    workers_.emplace_back(&JobSystem::WorkerLoop, this, i);
+  }
+}
+
+JobSystem::~JobSystem() {
+  {
+    std::lock_guard<std::mutex> lock(wake_mutex_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+}
+
+void JobSystem::ParallelFor(size_t count, size_t grain, const RangeFunc& func) {
+  grain = std::max<size_t>(grain, 1);
+  if (count <= grain || workers_.empty()) {
+    if (count > 0) {
+      func(0, count);
+    }
+    return;
+  }
+
+  size_t job_count = (count + grain - 1) / grain;
+  std::atomic<size_t> remaining{job_count};
+
+  // Counted before pushing so that taking a job never sees fewer queued than there are
+  queued_ += job_count;
+
+  // Round robin over all queues, stealing evens out whatever imbalance is left
+  for (size_t i = 0; i < job_count; ++i) {
+    WorkQueue& queue = *queues_[i % queues_.size()];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.jobs.push_back(Job{&func, i * grain, std::min(count, (i + 1) * grain), &remaining});
+  }
+
+  {
+    // Workers check queued_ under this mutex, taking it here means none of them can miss the wakeup
+    std::lock_guard<std::mutex> lock(wake_mutex_);
+  }
+  wake_.notify_all();
+
+  while (remaining.load(std::memory_order_acquire) > 0) {
+    Job job;
+    if (TakeJob(0, job)) {
+      Execute(job);
+    } else {
+      std::this_thread::yield();
+    }
+  }
+}
+
+void JobSystem::WorkerLoop(uint32_t index) {
+  while (true) {
+    Job job;
+    if (TakeJob(index, job)) {
+      Execute(job);
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(wake_mutex_);
+    wake_.wait(lock, [this]() { return stop_ || queued_.load() > 0; });
+    if (stop_) {
+      return;
+    }
+  }
+}
+
+bool JobSystem::TakeJob(uint32_t index, Job& job) {
+  {
+    WorkQueue& own = *queues_[index];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (!own.jobs.empty()) {
+      job = own.jobs.back();
+      own.jobs.pop_back();
+      --queued_;
+      return true;
+    }
+  }
+
+  for (size_t offset = 1; offset < queues_.size(); ++offset) {
+    WorkQueue& victim = *queues_[(index + offset) % queues_.size()];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.jobs.empty()) {
+      job = victim.jobs.front();
+      victim.jobs.pop_front();
+      --queued_;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void JobSystem::Execute(const Job& job) {
+  (*job.func)(job.begin, job.end);
+  job.remaining->fetch_sub(1, std::memory_order_acq_rel);
+}
\ No newline at end of file
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Pool of worker threads executing range jobs. Every worker owns a queue, takes jobs from its back
+// and steals from the front of other queues once its own one is empty. The thread calling
+// ParallelFor works on its own queue as well, so it's never idle while waiting.
+//
+// ParallelFor must only be called from one thread at a time, and not from inside a job.
+class JobSystem {
+public:
+  using RangeFunc = std::function<void(size_t begin, size_t end)>;
+
+  // One worker per core besides the calling thread by default
+  explicit JobSystem(uint32_t worker_count = DefaultWorkerCount());
+  ~JobSystem();
+
+  JobSystem(const JobSystem&) = delete;
+  JobSystem& operator=(const JobSystem&) = delete;
+
+  // Splits [0, count) into ranges of at most grain elements, runs func on every range in parallel
+  // and returns once all of them are done
+  void ParallelFor(size_t count, size_t grain, const RangeFunc& func);
+
+  uint32_t GetThreadCount() const { return static_cast<uint32_t>(queues_.size()); }
+
+  static uint32_t DefaultWorkerCount();
+
+private:
+  struct Job {
+    const RangeFunc* func;
+    size_t begin;
+    size_t end;
+    std::atomic<size_t>* remaining;
+  };
+
+  struct WorkQueue {
+    std::mutex mutex;
+    std::deque<Job> jobs;
+  };
+
+  void WorkerLoop(uint32_t index);
+  bool TakeJob(uint32_t index, Job& job);
+  void Execute(const Job& job);
+
+  // queues_[0] belongs to the thread calling ParallelFor, queues_[i] to workers_[i - 1]
+  std::vector<std::unique_ptr<WorkQueue>> queues_;
+  std::vector<std::thread> workers_;
+
+  std::mutex wake_mutex_;
+  std::condition_variable wake_;
+  // Jobs pushed but not taken yet
+  std::atomic<size_t> queued_{0};
+  bool stop_{false};
+};
\ No newline at end of file
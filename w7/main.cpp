@@ -7,21 +7,20 @@
 
 #include <vector>
 #include "entity.h"
+#include "entity_registry.hpp"
 #include "protocol.h"
 
 
-static std::vector<Entity> entities;
+static EntityRegistry<Entity> entities;
 static uint16_t my_entity = invalid_entity;
 
 void on_new_entity_packet(ENetPacket *packet)
 {
   Entity newEntity;
   deserialize_new_entity(packet, newEntity);
-  // TODO: Direct adressing, of course!
-  for (const Entity &e : entities)
-    if (e.eid == newEntity.eid)
-      return; // don't need to do anything, we already have entity
-  entities.push_back(newEntity);
+  if (entities.Contains(newEntity.eid))
+    return; // don't need to do anything, we already have entity
+  entities.Add(newEntity.eid, newEntity);
 }
 
 void on_set_controlled_entity(ENetPacket *packet)
@@ -29,19 +28,19 @@ void on_set_controlled_entity(ENetPacket *packet)
   deserialize_set_controlled_entity(packet, my_entity);
 }
 
-void on_snapshot(ENetPacket *packet)
+void on_world_snapshot(ENetPacket *packet)
 {
-  uint16_t eid = invalid_entity;
-  float x = 0.f; float y = 0.f; float ori = 0.f;
-  deserialize_snapshot(packet, eid, x, y, ori);
-  // TODO: Direct adressing, of course!
-  for (Entity &e : entities)
-    if (e.eid == eid)
+  static std::vector<EntitySnapshot> snapshots;
+  deserialize_world_snapshot(packet, snapshots);
+  for (const EntitySnapshot &snapshot : snapshots)
+  {
+    if (Entity *e = entities.Find(snapshot.eid))
     {
-      e.x = x;
-      e.y = y;
-      e.ori = ori;
+      e->x = snapshot.x;
+      e->y = snapshot.y;
+      e->ori = snapshot.ori;
     }
+  }
 }
 
 int main(int argc, const char **argv)
@@ -116,8 +115,8 @@ int main(int argc, const char **argv)
         case E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY:
           on_set_controlled_entity(event.packet);
           break;
-        case E_SERVER_TO_CLIENT_SNAPSHOT:
-          on_snapshot(event.packet);
+        case E_SERVER_TO_CLIENT_WORLD_SNAPSHOT:
+          on_world_snapshot(event.packet);
           break;
         };
         break;
@@ -131,17 +130,15 @@ int main(int argc, const char **argv)
       bool right = IsKeyDown(KEY_RIGHT);
       bool up = IsKeyDown(KEY_UP);
       bool down = IsKeyDown(KEY_DOWN);
-      // TODO: Direct adressing, of course!
-      for (Entity &e : entities)
-        if (e.eid == my_entity)
-        {
-          // Update
-          float thr = (up ? 1.f : 0.f) + (down ? -1.f : 0.f);
-          float steer = (left ? -1.f : 0.f) + (right ? 1.f : 0.f);
+      if (entities.Contains(my_entity))
+      {
+        // Update
+        float thr = (up ? 1.f : 0.f) + (down ? -1.f : 0.f);
+        float steer = (left ? -1.f : 0.f) + (right ? 1.f : 0.f);
 
-          // Send
-          send_entity_input(serverPeer, my_entity, thr, steer);
-        }
+        // Send
+        send_entity_input(serverPeer, my_entity, thr, steer);
+      }
     }
 
     BeginDrawing();
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Allocator for ENet's small blocks: packet structs, message payloads and the commands queued per
+// send. Blocks are recycled through free lists of fixed size classes, each one behind its own spin
+// lock since packets are encoded on job threads and freed on the main one. Blocks larger than the
+// biggest class go straight to malloc. Memory taken by the pool is kept until the process exits.
+struct PacketPoolStats {
+  uint64_t pooled_allocs;    // Served by a size class
+  uint64_t slab_mallocs;     // Slabs malloc'ed whenever a size class ran dry
+  uint64_t fallback_allocs;  // Too large for any class, malloc'ed directly
+};
+
+// Same as enet_initialize, with the pool installed as ENet's allocator
+int enet_initialize_with_packet_pool();
+
+PacketPoolStats get_packet_pool_stats();
\ No newline at end of file
@@ -1,6 +1,7 @@
 #include "protocol.h"
 #include "quantisation.h"
 #include <cstring> // memcpy
+#include <algorithm> // min
 #include <iostream>
 
 void send_join(ENetPeer *peer)
@@ -11,15 +12,24 @@ void send_join(ENetPeer *peer)
   enet_peer_send(peer, 0, packet);
 }
 
-void send_new_entity(ENetPeer *peer, const Entity &ent)
+static ENetPacket *create_new_entity_packet(const Entity &ent)
 {
   ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(Entity),
                                                    ENET_PACKET_FLAG_RELIABLE);
   uint8_t *ptr = packet->data;
   *ptr = E_SERVER_TO_CLIENT_NEW_ENTITY; ptr += sizeof(uint8_t);
   memcpy(ptr, &ent, sizeof(Entity)); ptr += sizeof(Entity);
+  return packet;
+}
 
-  enet_peer_send(peer, 0, packet);
+void send_new_entity(ENetPeer *peer, const Entity &ent)
+{
+  enet_peer_send(peer, 0, create_new_entity_packet(ent));
+}
+
+void broadcast_new_entity(ENetHost *host, const Entity &ent)
+{
+  enet_host_broadcast(host, 0, create_new_entity_packet(ent));
 }
 
 void send_set_controlled_entity(ENetPeer *peer, uint16_t eid)
@@ -56,25 +66,35 @@ void send_entity_input(ENetPeer *peer, uint16_t eid, float thr, float ori)
 typedef PackedFloat<uint16_t, 11> PositionXQuantized;
 typedef PackedFloat<uint16_t, 10> PositionYQuantized;
 
-void send_snapshot(ENetPeer *peer, uint16_t eid, float x, float y, float ori)
+void broadcast_world_snapshot(ENetHost *host, const std::vector<EntitySnapshot> &snapshots)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t) +
-                                                   sizeof(uint16_t) +
-                                                   sizeof(uint16_t) +
-                                                   sizeof(uint8_t),
-                                                   ENET_PACKET_FLAG_UNSEQUENCED);
-  uint8_t *ptr = packet->data;
-  *ptr = E_SERVER_TO_CLIENT_SNAPSHOT; ptr += sizeof(uint8_t);
-  memcpy(ptr, &eid, sizeof(uint16_t)); ptr += sizeof(uint16_t);
-  PositionXQuantized xPacked(x, -16, 16);
-  PositionYQuantized yPacked(y, -8, 8);
-  uint8_t oriPacked = pack_float<uint8_t>(ori, -PI, PI, 8);
-  //printf("xPacked/unpacked %d %f\n", xPacked, x);
-  memcpy(ptr, &xPacked.packedVal, sizeof(uint16_t)); ptr += sizeof(uint16_t);
-  memcpy(ptr, &yPacked.packedVal, sizeof(uint16_t)); ptr += sizeof(uint16_t);
-  memcpy(ptr, &oriPacked, sizeof(uint8_t)); ptr += sizeof(uint8_t);
-
-  enet_peer_send(peer, 1, packet);
+  constexpr size_t kHeaderSize = sizeof(uint8_t) + sizeof(uint16_t);
+  constexpr size_t kRecordSize = sizeof(uint16_t) + sizeof(uint16_t) + sizeof(uint16_t) + sizeof(uint8_t);
+  constexpr size_t kMaxRecords = (kMaxWorldSnapshotPacketSize - kHeaderSize) / kRecordSize;
+
+  for (size_t first = 0; first < snapshots.size(); first += kMaxRecords)
+  {
+    uint16_t count = std::min(kMaxRecords, snapshots.size() - first);
+
+    ENetPacket *packet = enet_packet_create(nullptr, kHeaderSize + count * kRecordSize,
+                                                     ENET_PACKET_FLAG_UNSEQUENCED);
+    uint8_t *ptr = packet->data;
+    *ptr = E_SERVER_TO_CLIENT_WORLD_SNAPSHOT; ptr += sizeof(uint8_t);
+    memcpy(ptr, &count, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+    for (size_t i = first; i < first + count; ++i)
+    {
+      const EntitySnapshot &snapshot = snapshots[i];
+      PositionXQuantized xPacked(snapshot.x, -16, 16);
+      PositionYQuantized yPacked(snapshot.y, -8, 8);
+      uint8_t oriPacked = pack_float<uint8_t>(snapshot.ori, -PI, PI, 8);
+      memcpy(ptr, &snapshot.eid, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+      memcpy(ptr, &xPacked.packedVal, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+      memcpy(ptr, &yPacked.packedVal, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+      memcpy(ptr, &oriPacked, sizeof(uint8_t)); ptr += sizeof(uint8_t);
+    }
+
+    enet_host_broadcast(host, 1, packet);
+  }
 }
 
 MessageType get_packet_type(ENetPacket *packet)
@@ -111,17 +131,22 @@ void deserialize_entity_input(ENetPacket *packet, uint16_t &eid, float &thr, flo
   steer = steerPacked.packedVal == neutralPackedValue ? 0.f : steerPacked.unpack(-1.f, 1.f);
 }
 
-void deserialize_snapshot(ENetPacket *packet, uint16_t &eid, float &x, float &y, float &ori)
+void deserialize_world_snapshot(ENetPacket *packet, std::vector<EntitySnapshot> &snapshots)
 {
   uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
-  eid = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
-  uint16_t xPacked = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
-  uint16_t yPacked = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
-  PositionXQuantized xPackedVal(xPacked);
-  PositionYQuantized yPackedVal(yPacked);
-  uint8_t oriPacked = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
-  x = xPackedVal.unpack(-16, 16);
-  y = yPackedVal.unpack(-8, 8);
-  ori = unpack_float<uint8_t>(oriPacked, -PI, PI, 8);
+  uint16_t count = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
+  snapshots.resize(count);
+  for (EntitySnapshot &snapshot : snapshots)
+  {
+    snapshot.eid = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
+    uint16_t xPacked = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
+    uint16_t yPacked = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
+    PositionXQuantized xPackedVal(xPacked);
+    PositionYQuantized yPackedVal(yPacked);
+    uint8_t oriPacked = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
+    snapshot.x = xPackedVal.unpack(-16, 16);
+    snapshot.y = yPackedVal.unpack(-8, 8);
+    snapshot.ori = unpack_float<uint8_t>(oriPacked, -PI, PI, 8);
+  }
 }
 
@@ -1,6 +1,7 @@
 #pragma once
 #include <enet/enet.h>
 #include <cstdint>
+#include <vector>
 #include "entity.h"
 
 enum MessageType : uint8_t
@@ -9,19 +10,25 @@ enum MessageType : uint8_t
   E_SERVER_TO_CLIENT_NEW_ENTITY,
   E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY,
   E_CLIENT_TO_SERVER_INPUT,
-  E_SERVER_TO_CLIENT_SNAPSHOT
+  E_SERVER_TO_CLIENT_WORLD_SNAPSHOT
 };
 
+// World snapshots are split so that every packet fits into ENet's default MTU (1400)
+constexpr size_t kMaxWorldSnapshotPacketSize = 1200;
+
 void send_join(ENetPeer *peer);
 void send_new_entity(ENetPeer *peer, const Entity &ent);
+// Encodes the message once and shares the packet between all connected peers
+void broadcast_new_entity(ENetHost *host, const Entity &ent);
 void send_set_controlled_entity(ENetPeer *peer, uint16_t eid);
 void send_entity_input(ENetPeer *peer, uint16_t eid, float thr, float steer);
-void send_snapshot(ENetPeer *peer, uint16_t eid, float x, float y, float ori);
+// Every peer sees the whole world, the snapshot is encoded once and shared between connected peers
+void broadcast_world_snapshot(ENetHost *host, const std::vector<EntitySnapshot> &snapshots);
 
 MessageType get_packet_type(ENetPacket *packet);
 
 void deserialize_new_entity(ENetPacket *packet, Entity &ent);
 void deserialize_set_controlled_entity(ENetPacket *packet, uint16_t &eid);
 void deserialize_entity_input(ENetPacket *packet, uint16_t &eid, float &thr, float &steer);
-void deserialize_snapshot(ENetPacket *packet, uint16_t &eid, float &x, float &y, float &ori);
+void deserialize_world_snapshot(ENetPacket *packet, std::vector<EntitySnapshot> &snapshots);
 
@@ -1,25 +1,39 @@
 #include <enet/enet.h>
 #include <iostream>
 #include "entity.h"
+#include "entity_registry.hpp"
+#include "entity_arrays.hpp"
+#include "job_system.hpp"
 #include "protocol.h"
+#include "packet_pool.hpp"
 #include "mathUtils.h"
 #include <stdlib.h>
 #include <vector>
-#include <map>
 
-static std::vector<Entity> entities;
-static std::map<uint16_t, ENetPeer*> controlledMap;
+static EntityRegistry<Entity> entities;
+// Simulated state of entities, indexed as entities.Values()
+static EntityArrays entityStates;
+
+// Entities per job, a multiple of the SIMD width so that only the last job has a scalar tail
+constexpr size_t kEntitiesPerJob = 1024;
+static JobSystem jobs;
+// Peer controlling each entity
+static EidMap<ENetPeer*> controlledMap;
 
 void on_join(ENetPacket *packet, ENetPeer *peer, ENetHost *host)
 {
   // send all entities
-  for (const Entity &ent : entities)
+  for (size_t i = 0; i < entities.Size(); ++i)
+  {
+    Entity ent = entities.Values()[i];
+    entityStates.Load(i, ent);
     send_new_entity(peer, ent);
+  }
 
   // find max eid
-  uint16_t maxEid = entities.empty() ? invalid_entity : entities[0].eid;
-  for (const Entity &e : entities)
-    maxEid = std::max(maxEid, e.eid);
+  uint16_t maxEid = entities.Empty() ? invalid_entity : entities.Eids()[0];
+  for (uint16_t eid : entities.Eids())
+    maxEid = std::max(maxEid, eid);
   uint16_t newEid = maxEid + 1;
   uint32_t color = 0xff000000 +
                    0x00440000 * (rand() % 5) +
@@ -28,14 +42,14 @@ void on_join(ENetPacket *packet, ENetPeer *peer, ENetHost *host)
   float x = (rand() % 4) * 5.f;
   float y = (rand() % 4) * 5.f;
   Entity ent = {color, x, y, 0.f, (rand() / RAND_MAX) * 3.141592654f, 0.f, 0.f, newEid};
-  entities.push_back(ent);
+  entities.Add(newEid, ent);
+  entityStates.Add(ent);
 
   controlledMap[newEid] = peer;
 
 
   // send info about new entity to everyone
-  for (size_t i = 0; i < host->peerCount; ++i)
-    send_new_entity(&host->peers[i], ent);
+  broadcast_new_entity(host, ent);
   // send info about controlled entity
   send_set_controlled_entity(peer, newEid);
 }
@@ -45,17 +59,18 @@ void on_input(ENetPacket *packet)
   uint16_t eid = invalid_entity;
   float thr = 0.f; float steer = 0.f;
   deserialize_entity_input(packet, eid, thr, steer);
-  for (Entity &e : entities)
-    if (e.eid == eid)
-    {
-      e.thr = thr;
-      e.steer = steer;
-    }
+  uint32_t slot = entities.GetSlot(eid);
+  if (slot != EntityRegistry<Entity>::kInvalidSlot)
+  {
+    entityStates.thr[slot] = thr;
+    entityStates.steer[slot] = steer;
+  }
 }
 
 int main(int argc, const char **argv)
 {
-  if (enet_initialize() != 0)
+  // Snapshots allocate packets for every peer every tick, they are recycled instead of malloc'ed
+  if (enet_initialize_with_packet_pool() != 0)
   {
     printf("Cannot init ENet");
     return 1;
@@ -103,20 +118,16 @@ int main(int argc, const char **argv)
         break;
       };
     }
-    static int t = 0;
-    for (Entity &e : entities)
-    {
-      // simulate
-      simulate_entity(e, dt);
-      // send
-      for (size_t i = 0; i < server->peerCount; ++i)
-      {
-        ENetPeer *peer = &server->peers[i];
-        // skip this here in this implementation
-        //if (controlledMap[e.eid] != peer)
-        send_snapshot(peer, e.eid, e.x, e.y, e.ori);
-      }
-    }
+    // simulate
+    static std::vector<EntitySnapshot> snapshots;
+    snapshots.resize(entityStates.Size());
+    jobs.ParallelFor(entityStates.Size(), kEntitiesPerJob, [&](size_t begin, size_t end) {
+      simulate_entities(entityStates.Span(begin, end - begin), dt);
+      for (size_t i = begin; i < end; ++i)
+        snapshots[i] = {entities.Eids()[i], entityStates.x[i], entityStates.y[i], entityStates.ori[i]};
+    });
+    // send
+    broadcast_world_snapshot(server, snapshots);
     usleep(10000);
   }
 
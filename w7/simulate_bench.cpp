@@ -0,0 +1,126 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "entity.h"
+#include "entity_arrays.hpp"
+
+static constexpr float kDt = 0.01f;
+static constexpr int kTicks = 200;
+// simulate_entities uses approximate trigonometry, one step may differ from libm by this much
+static constexpr float kTolerance = 1e-4f;
+
+static std::vector<Entity> generate_entities(size_t count, std::mt19937& rng) {
+  std::uniform_real_distribution<float> coord(-16.f, 16.f);
+  std::uniform_real_distribution<float> ori(-3.14f, 3.14f);
+  std::uniform_real_distribution<float> speed(-3.f, 10.f);
+  std::uniform_int_distribution<int> control(-1, 1);
+
+  std::vector<Entity> entities(count);
+  for (size_t i = 0; i < count; ++i) {
+    Entity& entity = entities[i];
+    entity.x = coord(rng);
+    entity.y = coord(rng);
+    entity.ori = ori(rng);
+    entity.speed = speed(rng);
+    entity.thr = static_cast<float>(control(rng));
+    entity.steer = static_cast<float>(control(rng));
+    entity.eid = static_cast<uint16_t>(i);
+  }
+
+  return entities;
+}
+
+static EntityArrays to_arrays(const std::vector<Entity>& entities) {
+  EntityArrays arrays;
+  for (const Entity& entity : entities) {
+    arrays.Add(entity);
+  }
+  return arrays;
+}
+
+static bool bitwise_equal(const std::vector<float>& lhs, const std::vector<float>& rhs) {
+  return lhs.size() == rhs.size() && std::memcmp(lhs.data(), rhs.data(), lhs.size() * sizeof(float)) == 0;
+}
+
+// The dispatched kernel has to match the scalar one bit for bit, and every single step has to
+// stay within kTolerance of simulate_entity
+static bool check_determinism(size_t count, std::mt19937& rng) {
+  std::vector<Entity> entities = generate_entities(count, rng);
+  EntityArrays simd = to_arrays(entities);
+  EntityArrays scalar = to_arrays(entities);
+
+  for (int tick = 0; tick < kTicks; ++tick) {
+    for (size_t i = 0; i < count; ++i) {
+      simd.Load(i, entities[i]);
+    }
+
+    simulate_entities(simd.Span(), kDt);
+    simulate_entities_scalar(scalar.Span(), kDt);
+
+    if (!bitwise_equal(simd.x, scalar.x) || !bitwise_equal(simd.y, scalar.y) ||
+        !bitwise_equal(simd.speed, scalar.speed) || !bitwise_equal(simd.ori, scalar.ori)) {
+      printf("%s kernel diverged from the scalar one at tick %d\n", simulate_entities_isa(), tick);
+      return false;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+      Entity& reference = entities[i];
+      simulate_entity(reference, kDt);
+
+      if (std::fabs(reference.x - simd.x[i]) > kTolerance || std::fabs(reference.y - simd.y[i]) > kTolerance ||
+          std::fabs(reference.speed - simd.speed[i]) > kTolerance ||
+          std::fabs(reference.ori - simd.ori[i]) > kTolerance) {
+        printf("Entity %zu differs from simulate_entity at tick %d\n", i, tick);
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+template<typename Func>
+static double measure_ms(int iterations, Func&& func) {
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    func();
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  return std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+}
+
+int main(int argc, const char** argv) {
+  std::mt19937 rng(42);
+
+  // Odd count so that the scalar tail of the vector loops is covered as well
+  if (!check_determinism(1001, rng)) {
+    return 1;
+  }
+  printf("%s kernel matches the scalar one bit for bit over %d ticks\n\n", simulate_entities_isa(), kTicks);
+
+  printf("%10s %18s %12s %12s %10s\n", "entities", "simulate_entity ms", "scalar ms", "batch ms", "speedup");
+
+  for (size_t count : {1000, 10000, 100000}) {
+    std::vector<Entity> entities = generate_entities(count, rng);
+    EntityArrays scalar = to_arrays(entities);
+    EntityArrays batch = to_arrays(entities);
+
+    double reference_ms = measure_ms(100, [&]() {
+      for (Entity& entity : entities) {
+        simulate_entity(entity, kDt);
+      }
+    });
+    double scalar_ms = measure_ms(100, [&]() { simulate_entities_scalar(scalar.Span(), kDt); });
+    double batch_ms = measure_ms(100, [&]() { simulate_entities(batch.Span(), kDt); });
+
+    printf("%10zu %18.3f %12.3f %12.3f %9.1fx\n", count, reference_ms, scalar_ms, batch_ms,
+           reference_ms / batch_ms);
+  }
+
+  return 0;
+}
\ No newline at end of file